@@ -0,0 +1,192 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/bench.c
+ *
+ * Allocator benchmark for the hosted build
+ *
+ * Each workload keeps a fixed number of live slots and replaces a random one
+ * per step, so the heap reaches a steady state.  Fragmentation is how much of
+ * the heap and mapped footprint isn't live requested bytes at the end;
+ * external is the share of free heap space outside the largest free block.
+ *
+ * Usage: bench [ops per workload] [seed]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kmalloc.h"
+#include "mm.h"
+#include "shim.h"
+
+#define BENCH_SLOTS                             4096
+
+/**
+ * struct bench_load - one alloc/free mix
+ * @name: Printed name
+ * @min: Smallest request
+ * @max: Largest request
+ * @log: Pick sizes log-uniform instead of uniform between min and max
+ * @lifo: Free the newest allocation instead of a random one
+ */
+struct bench_load {
+        const char * name;
+        size_t min;
+        size_t max;
+        int log;
+        int lifo;
+};
+
+static const struct bench_load loads[] = {
+        {"fixed 64 B, lifo",            64,     64,             0, 1},
+        {"small 16-256 B",              16,     256,            0, 0},
+        {"medium 256 B-8 KB",           256,    8192,           0, 0},
+        {"log-uniform 16 B-64 KB",      16,     65536,          1, 0},
+        {"large 64 KB-1 MB",            65536,  1 << 20,        0, 0},
+};
+
+static void * slots[BENCH_SLOTS];
+static size_t sizes[BENCH_SLOTS];
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t pick_size(const struct bench_load * load)
+{
+        if(load->min == load->max)
+                return load->min;
+
+        if(load->log) {
+                int lo = __builtin_ctzl(load->min), hi = __builtin_ctzl(load->max);
+                int bits = lo + rand() % (hi - lo);
+
+                return ((size_t)1 << bits) + rand() % ((size_t)1 << bits);
+        }
+
+        return load->min + rand() % (load->max - load->min + 1);
+}
+
+/**
+ * run_load() - run one workload and print its results
+ * @load: Workload to run
+ * @ops: Number of alloc/free pairs
+ *
+ * Return: void
+ */
+static void run_load(const struct bench_load * load, long ops)
+{
+        int nslots = load->min >= MALLOC_MAPPED_THRESHOLD ? 64 : BENCH_SLOTS;
+        uint64_t live = 0, footprint;
+        struct kmalloc_stats stats;
+        double start, elapsed;
+        int top = 0;
+
+        for(int i = 0; i < nslots; i++) {
+                sizes[i] = pick_size(load);
+                slots[i] = kmalloc(sizes[i]);
+                live += sizes[i];
+        }
+
+        start = now();
+
+        for(long op = 0; op < ops; op++) {
+                int i;
+
+                if(load->lifo) {
+                        i = top;
+                        top = (top + 1) % nslots;
+                } else {
+                        i = rand() % nslots;
+                }
+
+                kfree(slots[i]);
+                live -= sizes[i];
+
+                sizes[i] = pick_size(load);
+                slots[i] = kmalloc(sizes[i]);
+                live += sizes[i];
+
+                if(!slots[i]) {
+                        printf("%-26s out of memory after %ld ops\n",
+                                load->name, op);
+                        exit(1);
+                }
+        }
+
+        elapsed = now() - start;
+        footprint = hosted_heap_bytes() + hosted_mapped_bytes();
+        kmalloc_get_stats(&stats);
+
+        printf("%-26s %12.0f ops/s %8.2f%% fragmentation %3u%% external\n",
+                load->name, 2 * ops / elapsed,
+                100.0 * (1.0 - (double)live / footprint), stats.fragmentation);
+
+        for(int i = 0; i < nslots; i++)
+                kfree(slots[i]);
+
+        return;
+}
+
+/**
+ * run_frames() - time the physical frame allocator
+ * @ops: Number of alloc/free pairs
+ *
+ * Return: void
+ */
+static void run_frames(long ops)
+{
+        static void * frames[BENCH_SLOTS];
+        int nframes = 1024;
+        double start, elapsed;
+
+        for(int i = 0; i < nframes; i++)
+                frames[i] = MM_pf_alloc();
+
+        start = now();
+
+        for(long op = 0; op < ops; op++) {
+                int i = rand() % nframes;
+
+                MM_pf_free(frames[i]);
+
+                if((frames[i] = MM_pf_alloc()) == MM_FRAME_EMPTY) {
+                        printf("frames: out of memory after %ld ops\n", op);
+                        exit(1);
+                }
+        }
+
+        elapsed = now() - start;
+
+        printf("%-26s %12.0f ops/s\n", "frames (MM_pf_alloc/free)",
+                2 * ops / elapsed);
+
+        for(int i = 0; i < nframes; i++)
+                MM_pf_free(frames[i]);
+
+        return;
+}
+
+int main(int argc, char ** argv)
+{
+        long ops = argc > 1 ? atol(argv[1]) : 200000;
+
+        srand(argc > 2 ? atoi(argv[2]) : 1);
+
+        hosted_init();
+
+        for(int i = 0; i < sizeof(loads) / sizeof(loads[0]); i++)
+                run_load(loads + i, loads[i].min >= MALLOC_MAPPED_THRESHOLD
+                        ? ops / 100 : ops);
+
+        run_frames(ops / 100);
+
+        return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/csum.c
+ *
+ * Checksum benchmark for the hosted build
+ *
+ * Checks each function against known values, then times it over a few
+ * buffer sizes.  crc32c() is run twice, with and without CPU_SSE42, to
+ * compare the crc32 instruction with the slicing-by-8 tables.  Cycles are
+ * TSC ticks, which only match core cycles at the TSC frequency.
+ *
+ * Usage: csum [megabytes per run]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+#include "checksum.h"
+#include "cpu.h"
+
+#define CSUM_BUFFER                             (1 << 20)
+
+static uint8_t buffer[CSUM_BUFFER];
+static volatile uint32_t sink;
+
+static const size_t sizes[] = {64, 1500, 4096, 65536, CSUM_BUFFER};
+
+static uint32_t run_crc32c(const void * buf, size_t n)
+{
+        return crc32c(0, buf, n);
+}
+
+static uint32_t run_internet(const void * buf, size_t n)
+{
+        return csum_internet(buf, n);
+}
+
+static uint32_t run_adler32(const void * buf, size_t n)
+{
+        return adler32(1, buf, n);
+}
+
+/**
+ * check() - compare against known answers
+ *
+ * Return: 0 if everything matches
+ */
+static int check(void)
+{
+        static const uint8_t packet[] = {
+                0x00, 0x01, 0xF2, 0x03, 0xF4, 0xF5, 0xF6, 0xF7
+        };
+        uint16_t sum = csum_internet(packet, sizeof(packet));
+        int bad = 0;
+
+        if(crc32c(0, "123456789", 9) != 0xE3069283)
+                bad = printf("crc32c: got %08X\n", crc32c(0, "123456789", 9));
+
+        /* Both paths must agree, also when split at odd lengths */
+        for(size_t n = 0; n < 200; n++) {
+                uint32_t hw, sw;
+
+                cpu_features |= CPU_SSE42;
+                hw = crc32c(crc32c(0, buffer, n / 3), buffer + n / 3,
+                        n - n / 3);
+                cpu_features &= ~CPU_SSE42;
+                sw = crc32c(0, buffer, n);
+                CPU_init();
+
+                if(hw != sw)
+                        bad = printf("crc32c: paths differ at %zu\n", n);
+        }
+
+        /* RFC 1071 example: the big endian sum is 0xDDF2 */
+        if(((uint8_t *)&sum)[0] != 0x22 || ((uint8_t *)&sum)[1] != 0x0D)
+                bad = printf("csum_internet: got %04X\n", sum);
+
+        if(adler32(1, "Wikipedia", 9) != 0x11E60398)
+                bad = printf("adler32: got %08X\n", adler32(1, "Wikipedia", 9));
+
+        return bad;
+}
+
+/**
+ * run() - time one function over each buffer size
+ * @name: Printed name
+ * @fn: Function to time
+ * @bytes: Bytes to checksum per size
+ *
+ * Return: void
+ */
+static void run(const char * name, uint32_t (* fn)(const void *, size_t),
+        size_t bytes)
+{
+        printf("%-22s", name);
+
+        for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+                size_t reps = bytes / sizes[i] + 1;
+                uint64_t start;
+
+                start = __rdtsc();
+
+                for(size_t r = 0; r < reps; r++)
+                        sink = fn(buffer, sizes[i]);
+
+                printf(" %9.2f", (double)reps * sizes[i]
+                        / (__rdtsc() - start));
+        }
+
+        printf("\n");
+
+        return;
+}
+
+int main(int argc, char ** argv)
+{
+        size_t bytes = (argc > 1 ? atol(argv[1]) : 64) << 20;
+        int sse42;
+
+        CPU_init();
+        CSUM_init();
+
+        for(int i = 0; i < CSUM_BUFFER; i++)
+                buffer[i] = rand();
+
+        if(check())
+                return 1;
+
+        sse42 = CPU_has(CPU_SSE42);
+
+        printf("bytes/cycle           ");
+        for(int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+                printf(" %9zu", sizes[i]);
+        printf("\n");
+
+        if(sse42)
+                run("crc32c (sse4.2)", run_crc32c, bytes);
+
+        cpu_features &= ~CPU_SSE42;
+        run("crc32c (slicing-by-8)", run_crc32c, bytes);
+        CPU_init();
+
+        run("internet checksum", run_internet, bytes);
+        run("adler32", run_adler32, bytes);
+
+        return 0;
+}
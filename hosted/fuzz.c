@@ -0,0 +1,322 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/fuzz.c
+ *
+ * libFuzzer style harness for kmalloc
+ *
+ * Input bytes are read as a list of operations on a small table of slots.
+ * Every live block is filled with a pattern and checked before it's touched
+ * again, so overlapping blocks or a bad copy in krealloc() abort right away.
+ *
+ * Built with -DHOSTED_LIBFUZZER it's a plain libFuzzer target; otherwise
+ * main() below runs random inputs, or replays the files it's given.
+ *
+ * Before any of that, check_back_to_back() frees mapped blocks that sit
+ * right next to each other, which random inputs only hit now and then.
+ *
+ * With -t every trace point is on, and the newest FUZZ_TRACE_DUMP events
+ * are printed at the end.
+ *
+ * Usage: fuzz [-n iterations] [-s seed] [-t] [input files...]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kmalloc.h"
+#include "shim.h"
+#include "trace.h"
+
+#define FUZZ_SLOTS                              64
+#define FUZZ_MAX_INPUT                          1024
+#define FUZZ_TRACE_DUMP                         32
+#define FUZZ_ADJACENT                           8       /* mapped blocks */
+
+enum {
+        FUZZ_MALLOC,
+        FUZZ_CALLOC,
+        FUZZ_REALLOC,
+        FUZZ_FREE,
+        FUZZ_ALIGNED,
+        FUZZ_ATOMIC,
+        FUZZ_DMA,
+        FUZZ_OPS
+};
+
+static struct {
+        uint8_t * ptr;
+        size_t size;
+        uint8_t fill;
+} slots[FUZZ_SLOTS];
+
+static void check(int i)
+{
+        for(size_t j = 0; j < slots[i].size; j++) {
+                if(slots[i].ptr[j] != slots[i].fill) {
+                        fprintf(stderr, "fuzz: slot %d (%p, %zu bytes) "
+                                "corrupt at byte %zu\n", i, slots[i].ptr,
+                                slots[i].size, j);
+                        abort();
+                }
+        }
+
+        return;
+}
+
+static void fill(int i, size_t size, uint8_t pattern)
+{
+        slots[i].size = size;
+        slots[i].fill = pattern;
+        memset(slots[i].ptr, pattern, size);
+
+        return;
+}
+
+static void release(int i)
+{
+        if(!slots[i].ptr)
+                return;
+
+        check(i);
+        kfree(slots[i].ptr);
+        slots[i].ptr = NULL;
+
+        return;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t n)
+{
+        for(size_t pos = 0; pos + 4 <= n; pos += 4) {
+                int op = data[pos] % FUZZ_OPS;
+                int i = data[pos + 1] % FUZZ_SLOTS;
+                size_t size = data[pos + 2] | (data[pos + 3] & 0x3F) << 8;
+                uint8_t * ptr;
+
+                /* Top two bits pick a large size, past the mapped threshold */
+                if((data[pos + 3] & 0xC0) == 0xC0)
+                        size *= 64;
+
+                if(op != FUZZ_REALLOC && op != FUZZ_FREE)
+                        release(i);
+
+                switch(op) {
+                case FUZZ_MALLOC:
+                        slots[i].ptr = kmalloc(size);
+                        break;
+                case FUZZ_CALLOC:
+                        slots[i].ptr = kcalloc(1, size);
+
+                        for(size_t j = 0; slots[i].ptr && j < size; j++) {
+                                if(slots[i].ptr[j]) {
+                                        fprintf(stderr, "fuzz: kcalloc(%zu) "
+                                                "not zero at byte %zu\n",
+                                                size, j);
+                                        abort();
+                                }
+                        }
+                        break;
+                case FUZZ_REALLOC:
+                        if(!slots[i].ptr || !size)
+                                continue;
+
+                        check(i);
+
+                        if(!(ptr = krealloc(slots[i].ptr, size)))
+                                continue;
+
+                        for(size_t j = 0; j < size && j < slots[i].size; j++) {
+                                if(ptr[j] != slots[i].fill) {
+                                        fprintf(stderr, "fuzz: krealloc lost "
+                                                "byte %zu\n", j);
+                                        abort();
+                                }
+                        }
+
+                        slots[i].ptr = ptr;
+                        break;
+                case FUZZ_FREE:
+                        release(i);
+                        continue;
+                case FUZZ_ALIGNED:
+                        slots[i].ptr = kmalloc_aligned(size,
+                                (size_t)1 << (data[pos + 2] % 14));
+
+                        if(slots[i].ptr && (uintptr_t)slots[i].ptr
+                                        % ((size_t)1 << (data[pos + 2] % 14))) {
+                                fprintf(stderr, "fuzz: kmalloc_aligned "
+                                        "returned %p\n", slots[i].ptr);
+                                abort();
+                        }
+                        break;
+                case FUZZ_ATOMIC:
+                        slots[i].ptr = kmalloc_atomic(size % 600);
+                        size %= 600;
+
+                        if(!slots[i].ptr)
+                                kmalloc_atomic_refill();
+                        break;
+                case FUZZ_DMA:
+                        slots[i].ptr = kmalloc_dma(size, NULL);
+                        break;
+                }
+
+                if(slots[i].ptr)
+                        fill(i, size, data[pos] ^ data[pos + 2]);
+        }
+
+        for(int i = 0; i < FUZZ_SLOTS; i++)
+                release(i);
+
+        return 0;
+}
+
+/**
+ * check_back_to_back() - free mapped blocks next to ones still in use
+ *
+ * A pointer to the start of one mapped region is also one past the end of
+ * the region below it, and kfree() once unmapped that one instead if it
+ * came first in the mapped list.  New regions go above the old ones and at
+ * the front of the list, so that takes a block that was moved: every other
+ * block is grown past its neighbour, last first, so each gets remapped
+ * just above the one moved before it.  Then each block is freed while the
+ * one just below it is still live and that one is checked, so unmapping
+ * the wrong one crashes here.
+ *
+ * Return: void
+ */
+static void check_back_to_back(void)
+{
+        size_t size = MALLOC_MAPPED_THRESHOLD;
+        int adjacent = 0;
+
+        for(int i = 0; i < FUZZ_ADJACENT; i++) {
+                slots[i].ptr = kmalloc(size);
+                if(!slots[i].ptr) {
+                        fprintf(stderr, "fuzz: kmalloc(%zu) failed\n", size);
+                        abort();
+                }
+
+                fill(i, size, 0xA0 + i);
+        }
+
+        for(int i = FUZZ_ADJACENT - 2; i >= 0; i -= 2) {
+                uint8_t * ptr = krealloc(slots[i].ptr, 3 * size);
+
+                if(ptr) {
+                        slots[i].ptr = ptr;
+                        fill(i, 3 * size, 0xA0 + i);
+                }
+        }
+
+        for(int i = 0; i < FUZZ_ADJACENT; i++) {
+                for(int j = 0; j < FUZZ_ADJACENT; j++) {
+                        if(!slots[i].ptr || !slots[j].ptr || slots[j].ptr
+                                        != slots[i].ptr + slots[i].size)
+                                continue;
+
+                        release(j);
+                        check(i);
+                        adjacent++;
+                }
+        }
+
+        for(int i = 0; i < FUZZ_ADJACENT; i++)
+                release(i);
+
+        if(!adjacent) {
+                fprintf(stderr, "fuzz: no mapped blocks ended up adjacent\n");
+                abort();
+        }
+
+        return;
+}
+
+int LLVMFuzzerInitialize(int * argc, char *** argv)
+{
+        hosted_init();
+        check_back_to_back();
+
+        return 0;
+}
+
+#ifndef HOSTED_LIBFUZZER
+static void replay(const char * path)
+{
+        static uint8_t data[1 << 20];
+        FILE * f = fopen(path, "rb");
+        size_t n;
+
+        if(!f) {
+                perror(path);
+                exit(1);
+        }
+
+        n = fread(data, 1, sizeof(data), f);
+        fclose(f);
+
+        LLVMFuzzerTestOneInput(data, n);
+        printf("%s: ok\n", path);
+
+        return;
+}
+
+int main(int argc, char ** argv)
+{
+        static uint8_t data[FUZZ_MAX_INPUT];
+        long iterations = 10000;
+        int opt, tracing = 0;
+
+        srand(1);
+
+        while((opt = getopt(argc, argv, "n:s:t")) != -1) {
+                switch(opt) {
+                case 'n':
+                        iterations = atol(optarg);
+                        break;
+                case 's':
+                        srand(atoi(optarg));
+                        break;
+                case 't':
+                        tracing = 1;
+                        break;
+                default:
+                        fprintf(stderr, "usage: %s [-n iterations] [-s seed] [-t] "
+                                "[input files...]\n", argv[0]);
+                        return 1;
+                }
+        }
+
+        LLVMFuzzerInitialize(&argc, &argv);
+
+        if(tracing)
+                trace_enable_all(1);
+
+        if(optind < argc) {
+                for(int i = optind; i < argc; i++)
+                        replay(argv[i]);
+
+                return 0;
+        }
+
+        for(long it = 0; it < iterations; it++) {
+                size_t n = rand() % FUZZ_MAX_INPUT;
+
+                for(size_t i = 0; i < n; i++)
+                        data[i] = rand();
+
+                LLVMFuzzerTestOneInput(data, n);
+        }
+
+        printf("fuzz: %ld inputs ok\n", iterations);
+
+        if(tracing) {
+                hosted_verbose = 1;
+                trace_dump(FUZZ_TRACE_DUMP);
+        }
+
+        return 0;
+}
+#endif /* #ifndef HOSTED_LIBFUZZER */
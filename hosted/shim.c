@@ -0,0 +1,341 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/shim.c
+ *
+ * Userspace stand-ins for the MMU and console, so kmalloc.c, arena.c, trace.c
+ * and the frame allocator in mm.c can run as a normal Linux program
+ *
+ * The heap and mapped regions sit at their kernel virtual addresses, backed
+ * by anonymous mmap()s; fresh pages read as zero just like demand paging.
+ * "Physical" RAM is a memfd, so frames from MM_pf_alloc() can be touched
+ * directly and MMU_map_frames() can alias them.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "multiboot.h"
+#include "jump_label.h"
+#include "printk.h"
+#include "shim.h"
+
+#define HOSTED_FRAME_MAPS                       64
+
+int hosted_verbose = 0;
+
+/* printk() above already checks hosted_verbose */
+struct static_key printk_debug_key = {1};
+
+static uint8_t * heap_base = NULL, * heap_break = NULL;
+static uint8_t * vmap_break = (uint8_t *)MM_VMAP_BASE;
+static uint64_t mapped_pages = 0;
+
+static int ram_fd = -1;
+static uint8_t * ram = NULL;
+
+/* MMU_map_frames() mappings, so unmapping them gives the frames back */
+static struct {
+        void * addr;
+        void * phys;
+        int n;
+} frame_maps[HOSTED_FRAME_MAPS];
+
+int printk(const char * fmt, ...)
+{
+        va_list args;
+        int ret;
+
+        if(!hosted_verbose)
+                return 0;
+
+        /* Skip a KERN_* level prefix */
+        if(fmt[0] == KERN_SOH[0] && fmt[1])
+                fmt += 2;
+
+        va_start(args, fmt);
+        ret = vfprintf(stderr, fmt, args);
+        va_end(args);
+
+        return ret;
+}
+
+int snprintk(char * buf, size_t size, const char * fmt, ...)
+{
+        va_list args;
+        int ret;
+
+        va_start(args, fmt);
+        ret = vsnprintf(buf, size, fmt, args);
+        va_end(args);
+
+        return ret;
+}
+
+/* No timer to refill buckets with; printk() is quiet by default anyway */
+int printk_ratelimit(struct printk_ratelimit * rs, const char * func)
+{
+        return 1;
+}
+
+/* printk() above writes straight to stderr; there's nothing to wait for */
+void printk_wait(int len)
+{
+        return;
+}
+
+/**
+ * hosted_init() - reserve the heap, make fake RAM and run MM_init() on it
+ *
+ * Return: void, exits on failure
+ */
+void hosted_init(void)
+{
+        struct {
+                struct multiboot_table_header table;
+                struct multiboot_mem_map map;
+                struct multiboot_mm_entry entry;
+                struct multiboot_header end;
+        } __attribute__((packed, aligned(8))) boot;
+
+        heap_base = mmap((void *)0x008000000000, HOSTED_HEAP_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+                | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if(heap_base != (void *)0x008000000000) {
+                perror("hosted: heap reservation");
+                exit(1);
+        }
+
+        heap_break = heap_base;
+
+        if((ram_fd = memfd_create("fragaria-ram", 0)) < 0
+                        || ftruncate(ram_fd, HOSTED_RAM_SIZE) < 0) {
+                perror("hosted: fake RAM");
+                exit(1);
+        }
+
+        ram = mmap(NULL, HOSTED_RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                ram_fd, 0);
+
+        if(ram == MAP_FAILED) {
+                perror("hosted: fake RAM");
+                exit(1);
+        }
+
+        boot.table.total_size = sizeof(boot);
+        boot.table.reserved = 0;
+        boot.map.header.type = MULTIBOOT_MEM_MAP;
+        boot.map.header.size = sizeof(boot.map) + sizeof(boot.entry);
+        boot.map.entry_size = sizeof(boot.entry);
+        boot.map.entry_version = 0;
+        boot.entry.base_addr = (uint64_t)ram;
+        boot.entry.length = HOSTED_RAM_SIZE;
+        boot.entry.type = MULTIBOOT_MM_TYPE_RAM;
+        boot.entry.reserved = 0;
+        boot.end.type = 0;
+        boot.end.size = sizeof(boot.end);
+
+        MM_init((struct multiboot_table_header *)&boot);
+
+        return;
+}
+
+uint64_t hosted_heap_bytes(void)
+{
+        return heap_break - heap_base;
+}
+
+uint64_t hosted_mapped_bytes(void)
+{
+        return mapped_pages * MM_PF_SIZE;
+}
+
+void * MMU_alloc_pages(int n)
+{
+        void * ret = heap_break;
+
+        if(heap_break + (uint64_t)n * MM_PF_SIZE > heap_base + HOSTED_HEAP_SIZE)
+                return MM_FRAME_EMPTY;
+
+        heap_break += (uint64_t)n * MM_PF_SIZE;
+
+        return ret;
+}
+
+void * MMU_alloc_page()
+{
+        return MMU_alloc_pages(1);
+}
+
+void MMU_free_page(void * page)
+{
+        page = (void *)((uint64_t)page & ~(MM_PF_SIZE - 1));
+
+        if((uint8_t *)page > heap_break)
+                return;
+
+        /* Dropped pages come back zeroed, same as a fresh demand page */
+        madvise(page, heap_break - (uint8_t *)page, MADV_DONTNEED);
+        heap_break = page;
+
+        return;
+}
+
+void * MMU_map_region(int n)
+{
+        void * ret;
+
+        if(n <= 0)
+                return MM_FRAME_EMPTY;
+
+        ret = mmap(vmap_break, (uint64_t)n * MM_PF_SIZE,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS
+                | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+
+        if(ret != vmap_break)
+                return MM_FRAME_EMPTY;
+
+        /* Address space is plentiful here; never reuse it */
+        vmap_break += (uint64_t)n * MM_PF_SIZE;
+        mapped_pages += n;
+
+        return ret;
+}
+
+/**
+ * find_frame_map() - find the MMU_map_frames() mapping holding an address
+ * @addr: Address to look up
+ *
+ * Return: Index into frame_maps, -1 if addr isn't in one
+ */
+static int find_frame_map(void * addr)
+{
+        for(int i = 0; i < HOSTED_FRAME_MAPS; i++) {
+                uint8_t * start = frame_maps[i].addr;
+
+                if(start && (uint8_t *)addr >= start && (uint8_t *)addr
+                                < start + frame_maps[i].n * MM_PF_SIZE)
+                        return i;
+        }
+
+        return -1;
+}
+
+void MMU_unmap_region(void * addr, int n)
+{
+        int i = find_frame_map(addr);
+
+        if(n <= 0)
+                return;
+
+        /* Like the kernel, unmapping mapped frames gives them back */
+        if(i >= 0) {
+                int first = ((uint8_t *)addr - (uint8_t *)frame_maps[i].addr)
+                        / MM_PF_SIZE;
+
+                for(int j = first; j < frame_maps[i].n && j < first + n; j++)
+                        MM_pf_free((uint8_t *)frame_maps[i].phys
+                                + j * MM_PF_SIZE);
+
+                if(first)
+                        frame_maps[i].n = first;
+                else
+                        frame_maps[i].addr = NULL;
+        }
+
+        munmap(addr, (uint64_t)n * MM_PF_SIZE);
+        mapped_pages -= n;
+
+        return;
+}
+
+int MMU_extend_region(void * addr, int n, int new_n)
+{
+        uint8_t * end = (uint8_t *)addr + (uint64_t)n * MM_PF_SIZE;
+
+        if(end != vmap_break)
+                return -1;
+
+        if(MMU_map_region(new_n - n) != end)
+                return -1;
+
+        return 0;
+}
+
+void * MMU_remap_region(void * addr, int n, int new_n)
+{
+        int i = find_frame_map(addr);
+        void * ret;
+
+        /* mremap() would grow a frame mapping into the frames after it, where
+         * the kernel adds demand pages; build the new range by hand */
+        if(i >= 0) {
+                uint64_t frames = (uint64_t)frame_maps[i].n * MM_PF_SIZE;
+
+                if((ret = MMU_map_region(new_n)) == MM_FRAME_EMPTY)
+                        return MM_FRAME_EMPTY;
+
+                if(mmap(ret, frames, PROT_READ | PROT_WRITE, MAP_SHARED
+                                | MAP_FIXED, ram_fd, (uint8_t *)frame_maps[i].phys
+                                - ram) != ret) {
+                        munmap(ret, (uint64_t)new_n * MM_PF_SIZE);
+                        mapped_pages -= new_n;
+                        return MM_FRAME_EMPTY;
+                }
+
+                memcpy((uint8_t *)ret + frames, (uint8_t *)addr + frames,
+                        (uint64_t)n * MM_PF_SIZE - frames);
+                munmap(addr, (uint64_t)n * MM_PF_SIZE);
+                mapped_pages -= n;
+                frame_maps[i].addr = ret;
+
+                return ret;
+        }
+
+        ret = mremap(addr, (uint64_t)n * MM_PF_SIZE,
+                (uint64_t)new_n * MM_PF_SIZE, MREMAP_MAYMOVE | MREMAP_FIXED,
+                vmap_break);
+
+        if(ret == MAP_FAILED)
+                return MM_FRAME_EMPTY;
+
+        vmap_break += (uint64_t)new_n * MM_PF_SIZE;
+        mapped_pages += new_n - n;
+
+        return ret;
+}
+
+void * MMU_map_frames(void * phys, int n)
+{
+        void * ret;
+        int slot;
+
+        for(slot = 0; slot < HOSTED_FRAME_MAPS && frame_maps[slot].addr; slot++)
+                ;
+
+        if(n <= 0 || slot == HOSTED_FRAME_MAPS)
+                return MM_FRAME_EMPTY;
+
+        ret = mmap(vmap_break, (uint64_t)n * MM_PF_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE,
+                ram_fd, (uint8_t *)phys - ram);
+
+        if(ret != vmap_break)
+                return MM_FRAME_EMPTY;
+
+        frame_maps[slot].addr = ret;
+        frame_maps[slot].phys = phys;
+        frame_maps[slot].n = n;
+
+        vmap_break += (uint64_t)n * MM_PF_SIZE;
+        mapped_pages += n;
+
+        return ret;
+}
@@ -0,0 +1,26 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/shim.h
+ *
+ * Header for the userspace stand-ins used by the hosted build
+ *
+ */
+
+#ifndef SHIM_H
+#define SHIM_H                                  1
+
+#include <stdint.h>
+
+/* Fake physical RAM handed to MM_init() through a made up multiboot table */
+#define HOSTED_RAM_SIZE                         (256UL << 20)
+
+/* Address space reserved for the kernel heap at its real base */
+#define HOSTED_HEAP_SIZE                        (16UL << 30)
+
+extern int hosted_verbose;
+
+void hosted_init(void);
+uint64_t hosted_heap_bytes(void);
+uint64_t hosted_mapped_bytes(void);
+
+#endif /* #ifndef SHIM_H */
@@ -0,0 +1,176 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/hosted/tracedump.c
+ *
+ * Decoder for trace_export() output
+ *
+ * Reads a serial capture, skips everything up to TRACE_EXPORT_MAGIC and
+ * prints the events with the names and formats the kernel sent along, so it
+ * keeps working when trace points get added.  Times are TSC ticks since the
+ * oldest event on that CPU.
+ *
+ * Usage: tracedump [capture file]       (stdin without one)
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define TRACEDUMP_MAX_EVENTS                    256
+#define TRACEDUMP_MAX_ARGS                      4
+
+static char names[TRACEDUMP_MAX_EVENTS][256];
+static char formats[TRACEDUMP_MAX_EVENTS][256];
+
+static void read_exact(FILE * in, void * buf, size_t len)
+{
+        if(fread(buf, 1, len, in) != len) {
+                fprintf(stderr, "tracedump: capture ends early\n");
+                exit(1);
+        }
+}
+
+/**
+ * format_ok() - check a format from the capture is safe to hand to printf()
+ * @format: Format
+ *
+ * It comes from the file, so anything could be in it.  Allows literal text,
+ * %% and at most TRACEDUMP_MAX_ARGS conversions that read an unsigned long
+ * (%lu, %lx and friends, with flags, width and precision) or %c.  No %s,
+ * %n or * widths.
+ *
+ * Return: nonzero if it's safe
+ */
+static int format_ok(const char * format)
+{
+        int args = 0;
+
+        for(const char * p = format; *p; p++) {
+                if(*p != '%')
+                        continue;
+
+                p++;
+                if(*p == '%')
+                        continue;
+
+                while(*p && strchr("-+ #0", *p))
+                        p++;
+                while(*p >= '0' && *p <= '9')
+                        p++;
+                if(*p == '.') {
+                        p++;
+                        while(*p >= '0' && *p <= '9')
+                                p++;
+                }
+
+                if(*p == 'l') {
+                        p++;
+                        if(!*p || !strchr("udixXo", *p))
+                                return 0;
+                } else if(*p != 'c') {
+                        return 0;
+                }
+
+                if(++args > TRACEDUMP_MAX_ARGS)
+                        return 0;
+        }
+
+        return 1;
+}
+
+/**
+ * find_magic() - skip console text up to the start of an export
+ * @in: Capture
+ *
+ * Return: 0 once the magic has been read, -1 at end of file
+ */
+static int find_magic(FILE * in)
+{
+        const char * magic = TRACE_EXPORT_MAGIC;
+        size_t matched = 0;
+        int c;
+
+        while((c = fgetc(in)) != EOF) {
+                if(c == magic[matched]) {
+                        if(++matched == strlen(magic))
+                                return 0;
+                } else {
+                        matched = c == magic[0];
+                }
+        }
+
+        return -1;
+}
+
+int main(int argc, char ** argv)
+{
+        FILE * in = stdin;
+        uint32_t header[3];
+
+        if(argc > 1 && !(in = fopen(argv[1], "rb"))) {
+                perror(argv[1]);
+                return 1;
+        }
+
+        if(find_magic(in)) {
+                fprintf(stderr, "tracedump: no %s export found\n",
+                        TRACE_EXPORT_MAGIC);
+                return 1;
+        }
+
+        read_exact(in, header, sizeof(header));
+
+        if(header[0] > TRACEDUMP_MAX_EVENTS
+                        || header[2] != sizeof(struct trace_event)) {
+                fprintf(stderr, "tracedump: bad header %u events, %u bytes\n",
+                        header[0], header[2]);
+                return 1;
+        }
+
+        for(uint32_t i = 0; i < header[0]; i++) {
+                uint8_t len[2];
+
+                read_exact(in, len, 2);
+                read_exact(in, names[i], len[0]);
+                read_exact(in, formats[i], len[1]);
+                names[i][len[0]] = '\0';
+                formats[i][len[1]] = '\0';
+        }
+
+        for(uint32_t cpu = 0; cpu < header[1]; cpu++) {
+                struct trace_event e;
+                uint64_t count, base = 0;
+
+                read_exact(in, &count, sizeof(count));
+                printf("cpu %u: %lu events\n", cpu, count);
+
+                for(uint64_t i = 0; i < count; i++) {
+                        read_exact(in, &e, sizeof(e));
+
+                        if(!i)
+                                base = e.tsc;
+
+                        if(e.id >= header[0]) {
+                                printf("    %12lu unknown event %u\n",
+                                        e.tsc - base, e.id);
+                                continue;
+                        }
+
+                        printf("    %12lu %-12s ", e.tsc - base, names[e.id]);
+
+                        if(format_ok(formats[e.id]))
+                                printf(formats[e.id], e.args[0], e.args[1],
+                                        e.args[2], e.args[3]);
+                        else
+                                printf("%lx %lx %lx %lx", e.args[0],
+                                        e.args[1], e.args[2], e.args[3]);
+                        putchar('\n');
+                }
+        }
+
+        return 0;
+}
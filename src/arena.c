@@ -0,0 +1,223 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/arena.c
+ *
+ * Arena allocator for short lived objects that all get freed together
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "mm.h"
+#include "printk.h"
+
+#define CHUNK_HEADER_SIZE \
+(sizeof(struct arena_chunk) + ARENA_ALIGNMENT -\
+(sizeof(struct arena_chunk) % ARENA_ALIGNMENT))
+
+/**
+ * new_chunk() - map a chunk with room for at least size bytes
+ * @prev: Chunk it follows, NULL for the first
+ * @size: Bytes needed past the chunk header
+ *
+ * Return: struct arena_chunk * new chunk, NULL on fail
+ */
+static struct arena_chunk * new_chunk(struct arena_chunk * prev, size_t size)
+{
+        struct arena_chunk * chunk;
+        int pages;
+
+        pages = (CHUNK_HEADER_SIZE + size + MM_PF_SIZE - 1) / MM_PF_SIZE;
+
+        if(pages < ARENA_CHUNK_PAGES)
+                pages = ARENA_CHUNK_PAGES;
+
+        chunk = MMU_map_region(pages);
+
+        if(chunk == MM_FRAME_EMPTY) {
+                pr_warn("ARENA: failed to map %d pages\n", pages);
+                return NULL;
+        }
+
+        chunk->prev = prev;
+        chunk->pages = pages;
+
+        return chunk;
+}
+
+/**
+ * use_chunk() - point the arena's bump pointer at the start of a chunk
+ * @arena: Arena to update
+ * @chunk: Chunk to allocate from
+ * @start: First usable byte in chunk
+ *
+ * Return: void
+ */
+static void use_chunk(struct arena * arena, struct arena_chunk * chunk,
+        uint8_t * start)
+{
+        arena->chunk = chunk;
+        arena->cur = start;
+        arena->end = (uint8_t *)chunk + chunk->pages * MM_PF_SIZE;
+
+        return;
+}
+
+/**
+ * first_free() - first byte of the first chunk after the arena itself
+ * @chunk: First chunk of an arena
+ *
+ * Return: uint8_t * start of allocatable space
+ */
+static uint8_t * first_free(struct arena_chunk * chunk)
+{
+        return (uint8_t *)chunk + CHUNK_HEADER_SIZE + sizeof(struct arena);
+}
+
+/**
+ * free_chunks() - unmap chunks back to (but not including) a stopping point
+ * @arena: Arena that owns the chunks
+ * @stop: Chunk to keep, with every chunk before it
+ *
+ * Return: void
+ */
+static void free_chunks(struct arena * arena, struct arena_chunk * stop)
+{
+        struct arena_chunk * chunk = arena->chunk;
+
+        while(chunk != stop) {
+                struct arena_chunk * prev = chunk->prev;
+
+                MMU_unmap_region(chunk, chunk->pages);
+                chunk = prev;
+        }
+
+        return;
+}
+
+/**
+ * arena_create() - make a new arena
+ * @size: Expected total size in bytes, 0 for the default chunk size
+ *
+ * The arena grows past size as needed; it only sets the first chunk.
+ *
+ * Return: struct arena * new arena, NULL on fail
+ */
+struct arena * arena_create(size_t size)
+{
+        struct arena_chunk * chunk;
+        struct arena * arena;
+
+        if(!(chunk = new_chunk(NULL, sizeof(struct arena) + size)))
+                return NULL;
+
+        arena = (struct arena *)((uint8_t *)chunk + CHUNK_HEADER_SIZE);
+        use_chunk(arena, chunk, first_free(chunk));
+
+        return arena;
+}
+
+/**
+ * arena_alloc() - bump allocate from an arena
+ * @arena: Arena to allocate from
+ * @size: Number of bytes to allocate
+ * @align: Power of two alignment, 0 for ARENA_ALIGNMENT
+ *
+ * Memory is only given back by arena_reset(), arena_release() or
+ * arena_destroy(); there is no per-object free.
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+void * arena_alloc(struct arena * arena, size_t size, size_t align)
+{
+        struct arena_chunk * chunk;
+        uintptr_t ptr;
+
+        if(!align)
+                align = ARENA_ALIGNMENT;
+
+        if(align & (align - 1))
+                return NULL;
+
+        ptr = ((uintptr_t)arena->cur + align - 1) & ~(align - 1);
+
+        /* Doesn't fit, start a new chunk; anything left in this one is
+         * wasted until the arena is reset */
+        if(ptr + size > (uintptr_t)arena->end || ptr + size < ptr) {
+                if(!(chunk = new_chunk(arena->chunk, size + align)))
+                        return NULL;
+
+                use_chunk(arena, chunk, (uint8_t *)chunk + CHUNK_HEADER_SIZE);
+                ptr = ((uintptr_t)arena->cur + align - 1) & ~(align - 1);
+        }
+
+        arena->cur = (uint8_t *)(ptr + size);
+
+        return (void *)ptr;
+}
+
+/**
+ * arena_reset() - free everything allocated from an arena
+ * @arena: Arena to reset
+ *
+ * Keeps the first chunk mapped so the arena can be reused.
+ *
+ * Return: void
+ */
+void arena_reset(struct arena * arena)
+{
+        struct arena_chunk * first = arena->chunk;
+
+        while(first->prev)
+                first = first->prev;
+
+        free_chunks(arena, first);
+        use_chunk(arena, first, first_free(first));
+
+        return;
+}
+
+/**
+ * arena_destroy() - free an arena and everything allocated from it
+ * @arena: Arena to destroy
+ *
+ * Return: void
+ */
+void arena_destroy(struct arena * arena)
+{
+        free_chunks(arena, NULL);
+
+        return;
+}
+
+/**
+ * arena_mark() - save an arena's position to start a temporary scope
+ * @arena: Arena to mark
+ *
+ * Marks nest; releasing one also releases any taken after it.
+ *
+ * Return: struct arena_mark to pass to arena_release()
+ */
+struct arena_mark arena_mark(struct arena * arena)
+{
+        struct arena_mark mark = {arena->chunk, arena->cur};
+
+        return mark;
+}
+
+/**
+ * arena_release() - free everything allocated since a mark
+ * @arena: Arena the mark was taken from
+ * @mark: Mark from arena_mark()
+ *
+ * Return: void
+ */
+void arena_release(struct arena * arena, struct arena_mark mark)
+{
+        free_chunks(arena, mark.chunk);
+        use_chunk(arena, mark.chunk, mark.cur);
+
+        return;
+}
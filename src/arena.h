@@ -0,0 +1,63 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/arena.h
+ *
+ * Header for arena (bump) allocator
+ *
+ */
+
+#ifndef ARENA_H
+#define ARENA_H                                 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Chunks are at least this many pages; bigger requests get a chunk of their
+ * own size */
+#define ARENA_CHUNK_PAGES 16
+#define ARENA_ALIGNMENT 16
+
+/**
+ * struct arena_chunk - one mapped region backing an arena
+ * @prev: Chunk that was in use before this one, NULL for the first
+ * @pages: Size of the region in pages
+ *
+ * The chunk header sits at the start of its own region.
+ */
+struct arena_chunk {
+        struct arena_chunk * prev;
+        int pages;
+};
+
+/**
+ * struct arena - bump allocator over a list of chunks
+ * @chunk: Chunk being allocated from
+ * @cur: Next free byte in chunk
+ * @end: One past the last byte of chunk
+ *
+ * The arena itself lives in its first chunk, right after the chunk header.
+ */
+struct arena {
+        struct arena_chunk * chunk;
+        uint8_t * cur;
+        uint8_t * end;
+};
+
+/**
+ * struct arena_mark - saved arena position for a temporary scope
+ * @chunk: Chunk in use when the mark was taken
+ * @cur: Bump pointer when the mark was taken
+ */
+struct arena_mark {
+        struct arena_chunk * chunk;
+        uint8_t * cur;
+};
+
+struct arena * arena_create(size_t size);
+void * arena_alloc(struct arena * arena, size_t size, size_t align);
+void arena_reset(struct arena * arena);
+void arena_destroy(struct arena * arena);
+struct arena_mark arena_mark(struct arena * arena);
+void arena_release(struct arena * arena, struct arena_mark mark);
+
+#endif /* #ifndef ARENA_H */
@@ -23,6 +23,7 @@ start:
         call check_multiboot                    ; Perform checks
         call check_cpuid
         call check_long_mode
+        call enable_simd
 
         call set_up_page_tables                 ; Set up identity map
         call enable_paging
@@ -80,6 +81,46 @@ check_long_mode:
         jmp error
 
 
+; Turn on x87/SSE, and XSAVE with every state XCR0 can hold up to AVX.  The
+; kernel itself is built without SSE; only kernel_fpu_begin() regions use it.
+enable_simd:
+        mov eax, 1
+        cpuid
+        test edx, 1<<25                         ; SSE, always there with LM
+        jz .no_sse
+
+        mov eax, cr0
+        and eax, ~(1<<2)                        ; clear EM, no x87 emulation
+        or eax, 1<<1                            ; set MP
+        mov cr0, eax
+
+        mov eax, cr4
+        or eax, 3<<9                            ; set OSFXSR and OSXMMEXCPT
+        mov cr4, eax
+
+        fninit
+
+        test ecx, 1<<26                         ; Stop here without XSAVE
+        jz .done
+
+        mov eax, cr4
+        or eax, 1<<18                           ; set OSXSAVE
+        mov cr4, eax
+
+        mov eax, 0x0D                           ; XCR0 bits the CPU supports
+        xor ecx, ecx
+        cpuid
+        and eax, 0b111                          ; x87, SSE, AVX
+        xor edx, edx
+        xor ecx, ecx
+        xsetbv
+.done:
+        ret
+.no_sse:
+        mov al, "3"                             ; If no SSE, err 3
+        jmp error
+
+
 set_up_page_tables:
         mov eax, p3_table                       ; map first P4 entry to P3
         or eax, 0b11                            ; Set present+writable
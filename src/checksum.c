@@ -0,0 +1,192 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/checksum.c
+ *
+ * Checksum and CRC functions
+ *
+ * crc32c() uses the SSE4.2 crc32 instruction when CPU_init() found it, and
+ * slicing-by-8 tables otherwise.  The crc32 instruction works on general
+ * registers, so neither path needs kernel_fpu_begin().
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "checksum.h"
+#include "cpu.h"
+
+/* Unaligned 8 and 4 byte loads; x86 doesn't mind */
+typedef uint64_t __attribute__((may_alias, aligned(1))) uword_t;
+typedef uint32_t __attribute__((may_alias, aligned(1))) uhalf_t;
+
+static uint32_t crc_table[8][256];
+
+/**
+ * CSUM_init() - build the slicing-by-8 tables
+ *
+ * Return: void
+ */
+void CSUM_init(void)
+{
+        for(int i = 0; i < 256; i++) {
+                uint32_t crc = i;
+
+                for(int j = 0; j < 8; j++)
+                        crc = crc & 1 ? crc >> 1 ^ CRC32C_POLY : crc >> 1;
+
+                crc_table[0][i] = crc;
+        }
+
+        /* Table k advances a byte through k more zero bytes */
+        for(int k = 1; k < 8; k++) {
+                for(int i = 0; i < 256; i++)
+                        crc_table[k][i] = crc_table[k - 1][i] >> 8
+                                ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+        }
+
+        return;
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t * p, size_t n)
+{
+        for(; n >= 8; n -= 8, p += 8) {
+                uint64_t w = *(uword_t *)p ^ crc;
+
+                crc = crc_table[7][w & 0xFF]
+                        ^ crc_table[6][w >> 8 & 0xFF]
+                        ^ crc_table[5][w >> 16 & 0xFF]
+                        ^ crc_table[4][w >> 24 & 0xFF]
+                        ^ crc_table[3][w >> 32 & 0xFF]
+                        ^ crc_table[2][w >> 40 & 0xFF]
+                        ^ crc_table[1][w >> 48 & 0xFF]
+                        ^ crc_table[0][w >> 56];
+        }
+
+        for(; n; n--)
+                crc = crc_table[0][(crc ^ *p++) & 0xFF] ^ crc >> 8;
+
+        return crc;
+}
+
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t * p, size_t n)
+{
+        uint64_t crc64 = crc;
+
+        for(; n >= 32; n -= 32, p += 32)
+                asm("crc32q 0(%1), %0\n\t"
+                        "crc32q 8(%1), %0\n\t"
+                        "crc32q 16(%1), %0\n\t"
+                        "crc32q 24(%1), %0"
+                        : "+r"(crc64)
+                        : "r"(p), "m"(*(const uint8_t (*)[32])p));
+
+        for(; n >= 8; n -= 8, p += 8)
+                asm("crc32q %1, %0" : "+r"(crc64) : "rm"(*(uword_t *)p));
+
+        for(; n; n--, p++)
+                asm("crc32b %1, %0" : "+r"(crc64) : "rm"(*p));
+
+        return crc64;
+}
+
+/**
+ * crc32c() - CRC-32C (Castagnoli), as used by iSCSI, ext4 and SCTP
+ * @crc: Result for the data before buf, 0 to start
+ * @buf: Data
+ * @n: Number of bytes
+ *
+ * Return: CRC of everything so far
+ */
+uint32_t crc32c(uint32_t crc, const void * buf, size_t n)
+{
+        if(CPU_has(CPU_SSE42))
+                return ~crc32c_hw(~crc, buf, n);
+
+        return ~crc32c_sw(~crc, buf, n);
+}
+
+/**
+ * csum_internet() - RFC 1071 Internet checksum
+ * @buf: Data
+ * @n: Number of bytes
+ *
+ * The ones' complement sum doesn't care about byte order, so this adds
+ * native 32 bit words into a 64 bit accumulator and folds at the end.  The
+ * result can be stored into a packet as is.
+ *
+ * Return: checksum, in the same byte order as buf
+ */
+uint16_t csum_internet(const void * buf, size_t n)
+{
+        const uint8_t * p = buf;
+        uint64_t sum = 0;
+
+        for(; n >= 16; n -= 16, p += 16) {
+                sum += ((uhalf_t *)p)[0];
+                sum += ((uhalf_t *)p)[1];
+                sum += ((uhalf_t *)p)[2];
+                sum += ((uhalf_t *)p)[3];
+        }
+
+        for(; n >= 4; n -= 4, p += 4)
+                sum += *(uhalf_t *)p;
+
+        if(n >= 2) {
+                sum += *(uint16_t *)p;
+                p += 2;
+                n -= 2;
+        }
+
+        /* A trailing odd byte is the first byte of a zero padded word */
+        if(n)
+                sum += *p;
+
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+        sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+        return ~sum;
+}
+
+/**
+ * adler32() - Adler-32, as used by zlib
+ * @adler: Result for the data before buf, 1 to start
+ * @buf: Data
+ * @n: Number of bytes
+ *
+ * Return: checksum of everything so far
+ */
+uint32_t adler32(uint32_t adler, const void * buf, size_t n)
+{
+        const uint8_t * p = buf;
+        uint32_t a = adler & 0xFFFF, b = adler >> 16;
+
+        while(n) {
+                size_t run = n < ADLER_NMAX ? n : ADLER_NMAX;
+
+                n -= run;
+
+                for(; run >= 8; run -= 8, p += 8) {
+                        a += p[0]; b += a;
+                        a += p[1]; b += a;
+                        a += p[2]; b += a;
+                        a += p[3]; b += a;
+                        a += p[4]; b += a;
+                        a += p[5]; b += a;
+                        a += p[6]; b += a;
+                        a += p[7]; b += a;
+                }
+
+                for(; run; run--) {
+                        a += *p++;
+                        b += a;
+                }
+
+                a %= ADLER_MOD;
+                b %= ADLER_MOD;
+        }
+
+        return b << 16 | a;
+}
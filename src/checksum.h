@@ -0,0 +1,27 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/checksum.h
+ *
+ * Header for checksum and CRC functions
+ *
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H                              1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CRC32C_POLY                             0x82F63B78  /* reflected */
+
+#define ADLER_MOD                               65521
+/* Most bytes before the Adler sums can overflow 32 bits */
+#define ADLER_NMAX                              5552
+
+void CSUM_init(void);
+
+uint32_t crc32c(uint32_t crc, const void * buf, size_t n);
+uint16_t csum_internet(const void * buf, size_t n);
+uint32_t adler32(uint32_t adler, const void * buf, size_t n);
+
+#endif /* #ifndef CHECKSUM_H */
@@ -0,0 +1,58 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/cpu.c
+ *
+ * CPU feature detection
+ *
+ */
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+uint32_t cpu_features = 0;
+
+/**
+ * CPU_init() - read CPUID into cpu_features
+ *
+ * Safe to call before anything else is set up; only runs cpuid.
+ *
+ * Return: void
+ */
+void CPU_init(void)
+{
+        uint32_t max, a, b, c, d;
+        uint64_t xcr0 = 0;
+
+        cpuid(0, 0, &max, &b, &c, &d);
+
+        cpuid(1, 0, &a, &b, &c, &d);
+
+        if(c & CPUID_1_ECX_SSE42)
+                cpu_features |= CPU_SSE42;
+        if(d & CPUID_1_EDX_PAT)
+                cpu_features |= CPU_PAT;
+
+        /* AVX is only usable once boot.asm has switched its state on */
+        if(c & CPUID_1_ECX_OSXSAVE) {
+                cpu_features |= CPU_XSAVE;
+                xcr0 = xgetbv(0);
+        }
+
+        if((c & CPUID_1_ECX_AVX) && (xcr0 & (XCR0_SSE | XCR0_AVX))
+                        == (XCR0_SSE | XCR0_AVX))
+                cpu_features |= CPU_AVX;
+
+        if(max >= 7) {
+                cpuid(7, 0, &a, &b, &c, &d);
+
+                if((b & CPUID_7_EBX_AVX2) && CPU_has(CPU_AVX))
+                        cpu_features |= CPU_AVX2;
+                if(b & CPUID_7_EBX_ERMS)
+                        cpu_features |= CPU_ERMS;
+                if(d & CPUID_7_EDX_FSRM)
+                        cpu_features |= CPU_FSRM;
+        }
+
+        return;
+}
@@ -0,0 +1,96 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/cpu.h
+ *
+ * Header for CPU feature detection
+ *
+ */
+
+#ifndef CPU_H
+#define CPU_H                                   1
+
+#include <stdint.h>
+
+/* Bits in cpu_features, filled in by CPU_init() */
+#define CPU_ERMS                                (1 << 0)  /* rep movsb/stosb */
+#define CPU_FSRM                                (1 << 1)  /* short rep movsb */
+#define CPU_SSE42                               (1 << 2)
+#define CPU_XSAVE                               (1 << 3)  /* enabled by boot */
+#define CPU_AVX                                 (1 << 4)  /* enabled in XCR0 */
+#define CPU_AVX2                                (1 << 5)
+#define CPU_PAT                                 (1 << 6)
+
+#define CPUID_1_ECX_SSE42                       (1 << 20)
+#define CPUID_1_ECX_XSAVE                       (1 << 26)
+#define CPUID_1_ECX_OSXSAVE                     (1 << 27)
+#define CPUID_1_ECX_AVX                         (1 << 28)
+#define CPUID_1_EDX_PAT                         (1 << 16)
+#define CPUID_7_EBX_AVX2                        (1 << 5)
+#define CPUID_7_EBX_ERMS                        (1 << 9)
+#define CPUID_7_EDX_FSRM                        (1 << 4)
+
+#define XCR0_X87                                (1 << 0)
+#define XCR0_SSE                                (1 << 1)
+#define XCR0_AVX                                (1 << 2)
+
+#define MSR_PAT                                 0x277
+
+extern uint32_t cpu_features;
+
+void CPU_init(void);
+
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t * a,
+        uint32_t * b, uint32_t * c, uint32_t * d)
+{
+        asm volatile("cpuid"
+                : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+                : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t xgetbv(uint32_t index)
+{
+        uint32_t lo, hi;
+
+        asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(index));
+
+        return (uint64_t)hi << 32 | lo;
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+        uint32_t lo, hi;
+
+        asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+
+        return (uint64_t)hi << 32 | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+        asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)val),
+                "d"((uint32_t)(val >> 32)));
+}
+
+static inline uint64_t rdtsc(void)
+{
+        uint32_t lo, hi;
+
+        asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+
+        return (uint64_t)hi << 32 | lo;
+}
+
+/**
+ * CPU_has() - check for a CPU feature
+ * @feature: CPU_* bit(s) to check
+ *
+ * Everything reads as missing until CPU_init() has run.
+ *
+ * Return: nonzero if all of the features are there
+ */
+static inline int CPU_has(uint32_t feature)
+{
+        return (cpu_features & feature) == feature;
+}
+
+#endif /* #ifndef CPU_H */
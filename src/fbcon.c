@@ -0,0 +1,605 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/fbcon.c
+ *
+ * Framebuffer text console
+ *
+ * Every glyph is rasterized once, in the framebuffer's own pixel format, so
+ * drawing a character is a copy per scanline into a back buffer in RAM.  The
+ * back buffer is a ring of text rows: scrolling moves the top row along and
+ * blanks one row instead of moving the rest.  FB_flush() copies to the
+ * write-combined framebuffer just the span of each row that changed, or the
+ * whole screen after a scroll; nothing is ever read back from VRAM.
+ *
+ * The whole-screen copy is one pass of long sequential writes, done at most
+ * once per flush however many lines scrolled by, and always in one go so
+ * the screen never shows half a scroll.  Changed spans are what
+ * FB_FLUSH_BUDGET limits: each FB_flush() copies at most that many bytes of
+ * them, carrying on from where the last one stopped.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fbcon.h"
+#include "font.h"
+#include "irq.h"
+#include "kmalloc.h"
+#include "mm.h"
+#include "multiboot.h"
+#include "printk.h"
+#include "string.h"
+#include "vga.h"
+
+/**
+ * struct fb_console - framebuffer console state
+ * @vram: Framebuffer, mapped write combining
+ * @back: Back buffer; rows * FB_CELL_HEIGHT scanlines of line bytes
+ * @glyphs: FONT_GLYPHS glyphs of FB_CELL_HEIGHT scanlines of glyph_line bytes
+ * @blank: One scanline of background
+ * @dirty_lo: First changed column of each screen row
+ * @dirty_hi: One past the last changed column of each screen row; 0 if clean
+ * @pitch: Bytes between framebuffer scanlines
+ * @line: Bytes of a back buffer scanline, the visible part of a pitch
+ * @glyph_line: Bytes of one glyph scanline
+ * @width: Pixels across
+ * @height: Pixels down
+ * @bytes: Bytes per pixel
+ * @cols: Text columns
+ * @rows: Text rows
+ * @top: Back buffer row shown at the top of the screen
+ * @cursor: Next cell to draw, counted from the top left of the screen
+ * @scrolled: Every row moved since the last flush
+ * @next_row: Screen row the next flush starts looking for changes at
+ * @active: Set up and drawing
+ */
+struct fb_console {
+        uint8_t * vram;
+        uint8_t * back;
+        uint8_t * glyphs;
+        uint8_t * blank;
+        uint16_t * dirty_lo;
+        uint16_t * dirty_hi;
+        uint32_t pitch;
+        uint32_t line;
+        uint32_t glyph_line;
+        uint32_t width;
+        uint32_t height;
+        int bytes;
+        int cols;
+        int rows;
+        int top;
+        int cursor;
+        int scrolled;
+        int next_row;
+        int active;
+};
+
+static struct fb_console fb;
+
+/**
+ * find_tag() - find the framebuffer tag in the multiboot table
+ * @multiboot: Multiboot2 table
+ *
+ * Return: the tag if it describes a direct color mode we can draw on, NULL
+ *      otherwise (text mode, a palette, or an odd pixel size)
+ */
+static struct multiboot_framebuff_info * find_tag(
+        struct multiboot_table_header * multiboot)
+{
+        for (int i = 8; i < multiboot->total_size;) {
+                struct multiboot_header * current =
+                        (struct multiboot_header *)((uint8_t *)multiboot + i);
+                struct multiboot_framebuff_info * info;
+
+                if (current->type == 0)
+                        break;
+
+                if (current->type == MULTIBOOT_FRAMEBUFF_INFO) {
+                        info = (struct multiboot_framebuff_info *)current;
+
+                        if (info->framebuffer_type
+                                        != MULTIBOOT_FRAMEBUFF_TYPE_RGB)
+                                return NULL;
+
+                        switch (info->framebuffer_bpp) {
+                        case 15:
+                        case 16:
+                        case 24:
+                        case 32:
+                                return info;
+                        default:
+                                return NULL;
+                        }
+                }
+
+                i += (current->size + 7) & 0xFFFFFFF8;
+        }
+
+        return NULL;
+}
+
+/**
+ * pixel() - pack a color into the framebuffer's format
+ * @info: Framebuffer tag
+ * @rgb: 0xRRGGBB
+ *
+ * Return: pixel value, to be stored little endian in fb.bytes bytes
+ */
+static uint32_t pixel(struct multiboot_framebuff_info * info, uint32_t rgb)
+{
+        struct multiboot_framebuff_rgb * f = &info->color_info.rgb;
+        uint32_t r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+
+        return (r >> (8 - f->framebuff_red_mask_size))
+                        << f->framebuff_red_field_position
+                | (g >> (8 - f->framebuff_green_mask_size))
+                        << f->framebuff_green_field_position
+                | (b >> (8 - f->framebuff_blue_mask_size))
+                        << f->framebuff_blue_field_position;
+}
+
+static void store_pixel(uint8_t * dst, uint32_t value)
+{
+        for (int i = 0; i < fb.bytes; i++)
+                dst[i] = value >> (8 * i);
+
+        return;
+}
+
+/**
+ * build_glyphs() - rasterize the font in the framebuffer's format
+ * @fg: Foreground pixel
+ * @bg: Background pixel
+ *
+ * Return: void
+ */
+static void build_glyphs(uint32_t fg, uint32_t bg)
+{
+        for (int g = 0; g < FONT_GLYPHS; g++) {
+                for (int y = 0; y < FB_CELL_HEIGHT; y++) {
+                        uint8_t bits = font8x8[g][y * FONT_HEIGHT
+                                / FB_CELL_HEIGHT];
+                        uint8_t * dst = fb.glyphs
+                                + (g * FB_CELL_HEIGHT + y) * fb.glyph_line;
+
+                        for (int x = 0; x < FB_CELL_WIDTH; x++) {
+                                store_pixel(dst + x * fb.bytes,
+                                        (bits >> x) & 1 ? fg : bg);
+                        }
+                }
+        }
+
+        for (int x = 0; x < fb.width; x++)
+                store_pixel(fb.blank + x * fb.bytes, bg);
+
+        return;
+}
+
+static uint8_t * back_row(int row)
+{
+        return fb.back + (fb.top + row) % fb.rows * FB_CELL_HEIGHT * fb.line;
+}
+
+/**
+ * mark_dirty() - note a changed cell
+ * @row: Screen row
+ * @col: Column
+ *
+ * Return: void
+ */
+static void mark_dirty(int row, int col)
+{
+        if (fb.dirty_hi[row] == 0) {
+                fb.dirty_lo[row] = col;
+                fb.dirty_hi[row] = col + 1;
+                return;
+        }
+
+        if (col < fb.dirty_lo[row])
+                fb.dirty_lo[row] = col;
+        if (col >= fb.dirty_hi[row])
+                fb.dirty_hi[row] = col + 1;
+
+        return;
+}
+
+/**
+ * draw_char() - draw a character into the back buffer at the cursor
+ * @c: Character; anything the font lacks is drawn as '?'
+ *
+ * Return: void
+ */
+static void draw_char(char c)
+{
+        int row = fb.cursor / fb.cols, col = fb.cursor % fb.cols;
+        uint8_t * dst = back_row(row) + col * fb.glyph_line;
+        uint8_t * glyph;
+
+        if (c < FONT_FIRST || c >= FONT_FIRST + FONT_GLYPHS)
+                c = '?';
+
+        glyph = fb.glyphs + (c - FONT_FIRST) * FB_CELL_HEIGHT * fb.glyph_line;
+
+        for (int y = 0; y < FB_CELL_HEIGHT; y++) {
+                memcpy(dst, glyph, fb.glyph_line);
+                dst += fb.line;
+                glyph += fb.glyph_line;
+        }
+
+        /* After a scroll the whole screen goes out anyway */
+        if (!fb.scrolled)
+                mark_dirty(row, col);
+
+        return;
+}
+
+/**
+ * scroll() - move the text up a row
+ *
+ * Only the new bottom row gets touched here; the whole screen goes out at
+ * the next flush.
+ *
+ * Return: void
+ */
+static void scroll(void)
+{
+        uint8_t * dst;
+
+        fb.top = (fb.top + 1) % fb.rows;
+
+        dst = back_row(fb.rows - 1);
+        for (int y = 0; y < FB_CELL_HEIGHT; y++)
+                memcpy(dst + y * fb.line, fb.blank, fb.line);
+
+        fb.scrolled = 1;
+        fb.cursor -= fb.cols;
+
+        return;
+}
+
+/**
+ * put_char() - write a character at the cursor; interrupts must be off
+ * @c: Character to print
+ *
+ * Return: void
+ */
+static void put_char(char c)
+{
+        if (c == '\n') {
+                fb.cursor = (fb.cursor / fb.cols + 1) * fb.cols;
+        } else if (c == '\r') {
+                fb.cursor -= fb.cursor % fb.cols;
+                return;
+        } else {
+                draw_char(c);
+                fb.cursor++;
+        }
+
+        if (fb.cursor >= fb.cols * fb.rows)
+                scroll();
+
+        return;
+}
+
+/**
+ * blit_rows() - copy part of some screen rows to the framebuffer
+ * @row: First screen row
+ * @n: Number of rows
+ * @col: First column
+ * @cols: Number of columns
+ *
+ * Return: void
+ */
+static void blit_rows(int row, int n, int col, int cols)
+{
+        for (int r = row; r < row + n; r++) {
+                uint8_t * src = back_row(r) + col * fb.glyph_line;
+                uint8_t * dst = fb.vram + r * FB_CELL_HEIGHT * fb.pitch
+                        + col * fb.glyph_line;
+
+                for (int y = 0; y < FB_CELL_HEIGHT; y++) {
+                        memcpy(dst, src, cols * fb.glyph_line);
+                        src += fb.line;
+                        dst += fb.pitch;
+                }
+        }
+
+        return;
+}
+
+/**
+ * flush() - copy what changed to the framebuffer; interrupts must be off
+ * @budget: Stop once about this many bytes of changed spans have been
+ *      copied; a scroll is always copied whole
+ *
+ * Return: void
+ */
+static void flush(uint64_t budget)
+{
+        uint64_t drawn = 0;
+        int start = fb.next_row;
+
+        if (fb.scrolled) {
+                blit_rows(0, fb.rows, 0, fb.cols);
+                memset(fb.dirty_hi, 0, fb.rows * sizeof(*fb.dirty_hi));
+                fb.scrolled = 0;
+                return;
+        }
+
+        for (int i = 0; i < fb.rows && drawn < budget; i++) {
+                int row = (start + i) % fb.rows;
+                int n = fb.dirty_hi[row] - fb.dirty_lo[row];
+
+                if (fb.dirty_hi[row] == 0)
+                        continue;
+
+                blit_rows(row, 1, fb.dirty_lo[row], n);
+                fb.dirty_hi[row] = 0;
+                drawn += (uint64_t)n * FB_CELL_HEIGHT * fb.glyph_line;
+
+                fb.next_row = (row + 1) % fb.rows;
+        }
+
+        return;
+}
+
+/**
+ * FB_probe() - check whether the loader left a framebuffer we can use
+ * @multiboot: Multiboot2 table
+ *
+ * Safe before memory management is up.  If this says yes the display isn't
+ * in text mode, so the VGA console can't be seen.
+ *
+ * Return: nonzero if FB_init() should work
+ */
+int FB_probe(struct multiboot_table_header * multiboot)
+{
+        return find_tag(multiboot) != NULL;
+}
+
+/**
+ * FB_init() - start the framebuffer console
+ * @multiboot: Multiboot2 table
+ *
+ * Maps the framebuffer, sets up the back buffer and glyph cache, then
+ * carries over what the VGA console had on screen so the boot messages so
+ * far stay visible.
+ *
+ * Context: not ISR; must be called after MM_init()
+ *
+ * Return: zero on success, -1 if there's no usable framebuffer or memory
+ */
+int FB_init(struct multiboot_table_header * multiboot)
+{
+        struct multiboot_framebuff_info * info = find_tag(multiboot);
+        uint8_t enable_ints = 0;
+        uint64_t phys, offset;
+        char * text;
+        int pages, len;
+
+        if (!info)
+                return -1;
+
+        fb.width = info->framebuffer_width;
+        fb.height = info->framebuffer_height;
+        fb.pitch = info->framebuffer_pitch;
+        fb.bytes = (info->framebuffer_bpp + 7) / 8;
+        fb.line = fb.width * fb.bytes;
+        fb.glyph_line = FB_CELL_WIDTH * fb.bytes;
+        fb.cols = fb.width / FB_CELL_WIDTH;
+        fb.rows = fb.height / FB_CELL_HEIGHT;
+
+        if (fb.cols == 0 || fb.rows == 0)
+                return -1;
+
+        phys = info->framebuffer_addr & ~(uint64_t)(MM_PF_SIZE - 1);
+        offset = info->framebuffer_addr - phys;
+        pages = (offset + (uint64_t)fb.pitch * fb.height + MM_PF_SIZE - 1)
+                / MM_PF_SIZE;
+
+        fb.vram = MMU_map_frames_wc((void *)phys, pages);
+        if (fb.vram == MM_FRAME_EMPTY) {
+                pr_warn("FB: failed to map %d pages\n", pages);
+                return -1;
+        }
+        fb.vram += offset;
+
+        fb.back = kmalloc((size_t)fb.rows * FB_CELL_HEIGHT * fb.line);
+        fb.glyphs = kmalloc(FONT_GLYPHS * FB_CELL_HEIGHT * fb.glyph_line);
+        fb.blank = kmalloc(fb.line);
+        fb.dirty_lo = kcalloc(fb.rows, sizeof(*fb.dirty_lo));
+        fb.dirty_hi = kcalloc(fb.rows, sizeof(*fb.dirty_hi));
+
+        if (!fb.back || !fb.glyphs || !fb.blank || !fb.dirty_lo
+                        || !fb.dirty_hi) {
+                pr_warn("FB: out of memory\n");
+                kfree(fb.back);
+                kfree(fb.glyphs);
+                kfree(fb.blank);
+                kfree(fb.dirty_lo);
+                kfree(fb.dirty_hi);
+                return -1;
+        }
+
+        build_glyphs(pixel(info, FB_FG_RGB), pixel(info, FB_BG_RGB));
+
+        /* Clear the whole framebuffer once, margins included; after this
+         * only the text area gets written */
+        for (int y = 0; y < fb.height; y++)
+                memcpy(fb.vram + y * fb.pitch, fb.blank, fb.line);
+        for (int y = 0; y < fb.rows * FB_CELL_HEIGHT; y++)
+                memcpy(fb.back + y * fb.line, fb.blank, fb.line);
+
+        fb.top = 0;
+        fb.cursor = 0;
+        fb.scrolled = 0;
+        fb.next_row = 0;
+
+        len = VGA_WIDTH * VGA_HEIGHT + VGA_HEIGHT;
+        text = kmalloc(len);
+
+        /* No printk drain may land between copying the VGA text and
+         * switching over, or its message would only reach the VGA shadow */
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        if (text) {
+                len = VGA_text(text, len);
+                for (int i = 0; i < len; i++)
+                        put_char(text[i]);
+        }
+
+        fb.active = 1;
+        flush(UINT64_MAX);
+
+        if (enable_ints)
+                STI;
+
+        kfree(text);
+
+        pr_info("FB: %ux%u, %d bpp, %dx%d text\n", fb.width, fb.height,
+                info->framebuffer_bpp, fb.cols, fb.rows);
+
+        return 0;
+}
+
+/**
+ * FB_write() - write a run of characters to the framebuffer console
+ * @buff: Characters to print
+ * @len: Number of characters
+ *
+ * The characters only reach the screen at the next FB_flush().  Does
+ * nothing before FB_init().
+ *
+ * Return: number of characters
+ */
+int FB_write(const char * buff, int len)
+{
+        uint8_t enable_ints = 0;
+
+        if (!fb.active)
+                return len;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        for (int i = 0; i < len; i++)
+                put_char(buff[i]);
+
+        if (enable_ints)
+                STI;
+
+        return len;
+}
+
+/**
+ * FB_clear() - blank the framebuffer console and home the cursor
+ *
+ * Like FB_write(), the screen only changes at the next FB_flush().
+ *
+ * Return: void
+ */
+void FB_clear()
+{
+        uint8_t enable_ints = 0;
+
+        if (!fb.active)
+                return;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        for (int y = 0; y < fb.rows * FB_CELL_HEIGHT; y++)
+                memcpy(fb.back + y * fb.line, fb.blank, fb.line);
+
+        fb.top = 0;
+        fb.cursor = 0;
+        fb.scrolled = 1;
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * FB_text_size() - size of the framebuffer console in characters
+ * @cols: Where to put the number of columns
+ * @rows: Where to put the number of rows
+ *
+ * Return: zero on success, -1 before FB_init()
+ */
+int FB_text_size(int * cols, int * rows)
+{
+        if (!fb.active)
+                return -1;
+
+        *cols = fb.cols;
+        *rows = fb.rows;
+
+        return 0;
+}
+
+/**
+ * flush_irqsave() - flush() with interrupts held off
+ * @budget: See flush()
+ *
+ * Return: void
+ */
+static void flush_irqsave(uint64_t budget)
+{
+        uint8_t enable_ints = 0;
+
+        if (!fb.active)
+                return;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        flush(budget);
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * FB_flush() - show what's been written to the framebuffer console
+ *
+ * Copies at most FB_FLUSH_BUDGET bytes of changed spans; if more changed,
+ * the rest is left for the next call.  printk calls this every drain, so
+ * it catches up within a few ticks.  A scroll still goes out whole.
+ *
+ * Return: void
+ */
+void FB_flush()
+{
+        flush_irqsave(FB_FLUSH_BUDGET);
+
+        return;
+}
+
+/**
+ * FB_sync() - show everything written to the framebuffer console so far
+ *
+ * Context: for panics, or anything else that can't wait for the next tick
+ *
+ * Return: void
+ */
+void FB_sync()
+{
+        flush_irqsave(UINT64_MAX);
+
+        return;
+}
@@ -0,0 +1,37 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/fbcon.h
+ *
+ * Header for the framebuffer text console
+ *
+ */
+
+#ifndef FBCON_H
+#define FBCON_H                                 1
+
+#include <stdint.h>
+
+#include "multiboot.h"
+
+/* Cell size on screen; font8x8 with every scanline drawn twice */
+#define FB_CELL_WIDTH                           8
+#define FB_CELL_HEIGHT                          16
+
+/* Most bytes of changed spans one FB_flush() copies, to bound how long it
+ * keeps interrupts off; about 2 ms at a slow 128 MB/s into write-combined
+ * memory */
+#define FB_FLUSH_BUDGET                         (256 * 1024)
+
+/* Light grey on black, like the VGA console */
+#define FB_FG_RGB                               0xAAAAAA
+#define FB_BG_RGB                               0x000000
+
+int FB_probe(struct multiboot_table_header *);
+int FB_init(struct multiboot_table_header *);
+int FB_write(const char *, int);
+void FB_flush(void);
+void FB_sync(void);
+void FB_clear(void);
+int FB_text_size(int *, int *);
+
+#endif /* #ifndef FBCON_H */
@@ -0,0 +1,21 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/font.h
+ *
+ * Header for the console font
+ *
+ */
+
+#ifndef FONT_H
+#define FONT_H                                  1
+
+#include <stdint.h>
+
+#define FONT_WIDTH                              8
+#define FONT_HEIGHT                             8
+#define FONT_FIRST                              0x20    /* space */
+#define FONT_GLYPHS                             95      /* through '~' */
+
+extern const uint8_t font8x8[FONT_GLYPHS][FONT_HEIGHT];
+
+#endif /* #ifndef FONT_H */
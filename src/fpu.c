@@ -0,0 +1,145 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/fpu.c
+ *
+ * Kernel use of the FPU and SIMD registers
+ *
+ * The kernel is built with -mno-sse and friends, so ordinary kernel code and
+ * interrupt handlers never touch vector registers and nothing saves them on
+ * interrupt entry.  Code that wants SIMD brackets it with kernel_fpu_begin()
+ * and kernel_fpu_end().  The only live vector state is then that of a region
+ * further down the stack, so a region saves state only when it interrupted
+ * another one, and puts it back when it ends.
+ *
+ */
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "fpu.h"
+#include "irq.h"
+#include "printk.h"
+
+static uint8_t fpu_area[KERNEL_FPU_NEST][KERNEL_FPU_AREA]
+        __attribute__((aligned(64)));
+static int fpu_depth = 0;
+static uint64_t fpu_mask = 0;
+
+/**
+ * FPU_init() - pick XSAVE or FXSAVE for nested regions
+ *
+ * boot.asm has already turned SSE and XSAVE on; this only records which
+ * state components a save has to cover.  Needs CPU_init() first.
+ *
+ * Return: void
+ */
+void FPU_init(void)
+{
+        uint32_t a, b, c, d;
+
+        if(!CPU_has(CPU_XSAVE))
+                return;
+
+        fpu_mask = xgetbv(0);
+
+        /* Size of the save area for everything enabled in XCR0 */
+        cpuid(0x0D, 0, &a, &b, &c, &d);
+
+        if(b > KERNEL_FPU_AREA) {
+                pr_warn("FPU: %d byte XSAVE area too big, SIMD disabled\n", b);
+                cpu_features &= ~(CPU_XSAVE | CPU_AVX | CPU_AVX2);
+                fpu_mask = 0;
+        }
+
+        return;
+}
+
+static inline void fpu_save(uint8_t * area)
+{
+        if(fpu_mask)
+                asm volatile("xsave64 (%0)"
+                        :
+                        : "r"(area), "a"((uint32_t)fpu_mask),
+                          "d"((uint32_t)(fpu_mask >> 32))
+                        : "memory");
+        else
+                asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+
+        return;
+}
+
+static inline void fpu_restore(uint8_t * area)
+{
+        if(fpu_mask)
+                asm volatile("xrstor64 (%0)"
+                        :
+                        : "r"(area), "a"((uint32_t)fpu_mask),
+                          "d"((uint32_t)(fpu_mask >> 32))
+                        : "memory");
+        else
+                asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+
+        return;
+}
+
+/**
+ * kernel_fpu_begin() - start a region that may use FPU/SIMD registers
+ *
+ * Safe in interrupt context.  Costs nothing unless it nests inside another
+ * region, in which case that region's registers are saved first.
+ *
+ * Return: void
+ */
+void kernel_fpu_begin(void)
+{
+        uint8_t enable_ints = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        if(fpu_depth >= KERNEL_FPU_NEST) {
+                pr_emerg("FPU regions nested too deep!!!\n"
+                        "FATAL... STOPPING.\n");
+                printk_flush();
+                asm("hlt");
+        }
+
+        if(fpu_depth > 0)
+                fpu_save(fpu_area[fpu_depth - 1]);
+
+        fpu_depth++;
+
+        if(enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * kernel_fpu_end() - end a region started by kernel_fpu_begin()
+ *
+ * Puts back the registers of the region this one interrupted, if any.
+ *
+ * Return: void
+ */
+void kernel_fpu_end(void)
+{
+        uint8_t enable_ints = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        fpu_depth--;
+
+        if(fpu_depth > 0)
+                fpu_restore(fpu_area[fpu_depth - 1]);
+
+        if(enable_ints)
+                STI;
+
+        return;
+}
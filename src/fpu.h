@@ -0,0 +1,25 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/fpu.h
+ *
+ * Header for kernel use of the FPU and SIMD registers
+ *
+ */
+
+#ifndef FPU_H
+#define FPU_H                                   1
+
+#include <stdint.h>
+
+/* Regions that can be live at once: task level, an IRQ, and a fault in it */
+#define KERNEL_FPU_NEST                         4
+
+/* Legacy area, XSAVE header and the AVX upper halves, rounded up */
+#define KERNEL_FPU_AREA                         1024
+
+void FPU_init(void);
+
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif /* #ifndef FPU_H */
@@ -11,8 +11,10 @@
 
 #include "gdt.h"
 #include "irq.h"
+#include "pit.h"        /* Used for hooking PIC handler to driver */
 #include "port_io.h"
 #include "printk.h"
+#include "trace.h"
 #include "ps2.h"        /* Used for hooking PIC handler to driver */
 #include "serial.h"     /* Used for hooking PIC handler to driver */
 
@@ -42,6 +44,9 @@ static void pic_handle(int irq, uint32_t error, void * cr2, void * arg)
         irq -= PIC_1;
 
         switch(irq) {
+        case PIC_PROG_TIMER:
+                        pit_pic_handle();
+                        break;
         case PIC_KEYBOARD:
                         ps2_pic_handle();
                         break; 
@@ -50,7 +55,7 @@ static void pic_handle(int irq, uint32_t error, void * cr2, void * arg)
                         serial_pic_handle();
                         break;
         default:
-                        printk("Unhandled PIC IRQ: %d\n", irq);
+                        pr_warn_ratelimited("Unhandled PIC IRQ: %d\n", irq);
         }
 
         IRQ_end_of_interrupt(irq);
@@ -69,22 +74,26 @@ static void pic_handle(int irq, uint32_t error, void * cr2, void * arg)
 void irq_c_handler(int irq, uint32_t error, void * cr2, 
         struct irq_stack_frame * frame)
 {
+        trace(IRQ_ENTER, irq, error, frame->rip);
 
         if (irq_table[irq].handler) {
                 irq_table[irq].handler(irq, error, cr2, irq_table[irq].arg);
         } else {
-                printk("ERROR: Unhandled interrupt: 0x%x\n", irq);
-                printk("    Error: %x\n", error);
-                printk("    CR2: %p\n", cr2);
-                printk("    Instruction Pointer: 0x%lx\n", frame->rip);
-                printk("    Code Segment: %d\n", frame->cs);
-                printk("    CPU Flags: %lx\n", frame->rflags);
-                printk("    Stack Pointer: 0x%lx\n", frame->rsp);
-                printk("    Stack Segment: %d\n", frame->ss);
-                printk("Unrecoverable error, stopping...\n");
+                pr_emerg("ERROR: Unhandled interrupt: 0x%x\n", irq);
+                pr_emerg("    Error: %x\n", error);
+                pr_emerg("    CR2: %p\n", cr2);
+                pr_emerg("    Instruction Pointer: 0x%lx\n", frame->rip);
+                pr_emerg("    Code Segment: %d\n", frame->cs);
+                pr_emerg("    CPU Flags: %lx\n", frame->rflags);
+                pr_emerg("    Stack Pointer: 0x%lx\n", frame->rsp);
+                pr_emerg("    Stack Segment: %d\n", frame->ss);
+                pr_emerg("Unrecoverable error, stopping...\n");
+                printk_flush();
                 asm("hlt");
         }
 
+        trace(IRQ_EXIT, irq);
+
         return;
 }
 
@@ -11,8 +11,14 @@
 
 #include <stdint.h>
 
+/* The hosted build (see hosted/) runs in userspace, where cli/sti fault */
+#ifdef FRAGARIA_HOSTED
+#define CLI
+#define STI
+#else
 #define CLI asm("cli")
 #define STI asm("sti")
+#endif
 
 #define IFLAGS_IF                               0x0200
 
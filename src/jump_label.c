@@ -0,0 +1,152 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/jump_label.c
+ *
+ * Static keys
+ *
+ * Every static_key_false() site is a 5 byte nop listed in __jump_table.
+ * Turning a key on rewrites each of its sites into a jmp to the on case, and
+ * turning it off puts the nop back, so checks for rarely used features cost
+ * nothing on hot paths until they're wanted.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "irq.h"
+#include "jump_label.h"
+#include "printk.h"
+#include "string.h"
+
+#ifndef FRAGARIA_HOSTED
+/* From linker.ld */
+extern struct jump_entry __jump_table_start[], __jump_table_end[];
+
+static const uint8_t jump_nop[JUMP_LABEL_NOP_SIZE] = {
+        0x0f, 0x1f, 0x44, 0x00, 0x00
+};
+
+/**
+ * make_jmp() - build the jmp rel32 for a site
+ * @entry: Site
+ * @insn: Where to put the JUMP_LABEL_NOP_SIZE bytes
+ *
+ * Return: void
+ */
+static void make_jmp(const struct jump_entry * entry, uint8_t * insn)
+{
+        int32_t rel = entry->target - (entry->code + JUMP_LABEL_NOP_SIZE);
+
+        insn[0] = 0xe9;
+        memcpy(insn + 1, &rel, sizeof(rel));
+
+        return;
+}
+
+/**
+ * patch_site() - switch one site between nop and jmp
+ * @entry: Site
+ * @enable: Nonzero for the jmp
+ *
+ * Refuses to touch a site that is neither the nop nor its own jmp, rather
+ * than corrupt code if the table is wrong.
+ *
+ * Return: void
+ */
+static void patch_site(const struct jump_entry * entry, int enable)
+{
+        uint8_t * code = (uint8_t *)entry->code;
+        uint8_t jmp[JUMP_LABEL_NOP_SIZE];
+
+        make_jmp(entry, jmp);
+
+        if (memcmp(code, jump_nop, JUMP_LABEL_NOP_SIZE)
+                        && memcmp(code, jmp, JUMP_LABEL_NOP_SIZE)) {
+                pr_err("JUMP: unexpected code at %p, not patching\n", code);
+                return;
+        }
+
+        memcpy(code, enable ? jmp : jump_nop, JUMP_LABEL_NOP_SIZE);
+
+        return;
+}
+
+/**
+ * jump_label_update() - patch every site of a key to match its state
+ * @key: Key that changed
+ *
+ * Context: Interrupts are held off so no handler runs a half written site;
+ *      there's only one CPU to stop.
+ *
+ * Return: void
+ */
+static void jump_label_update(struct static_key * key)
+{
+        uint8_t enable_ints = 0;
+        uint32_t a, b, c, d;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        for (struct jump_entry * e = __jump_table_start;
+                        e < __jump_table_end; e++) {
+                if (e->key == (uint64_t)key)
+                        patch_site(e, key->enabled);
+        }
+
+        /* Serialize so nothing prefetched from before the patch runs */
+        cpuid(0, 0, &a, &b, &c, &d);
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+#else
+static void jump_label_update(struct static_key * key)
+{
+        return;
+}
+#endif /* #ifndef FRAGARIA_HOSTED */
+
+/**
+ * static_key_enable() - turn a key on
+ * @key: Key
+ *
+ * Context: not ISR; patching walks the whole jump table
+ *
+ * Return: void
+ */
+void static_key_enable(struct static_key * key)
+{
+        if (key->enabled)
+                return;
+
+        key->enabled = 1;
+        jump_label_update(key);
+
+        return;
+}
+
+/**
+ * static_key_disable() - turn a key off
+ * @key: Key
+ *
+ * Context: not ISR; patching walks the whole jump table
+ *
+ * Return: void
+ */
+void static_key_disable(struct static_key * key)
+{
+        if (!key->enabled)
+                return;
+
+        key->enabled = 0;
+        jump_label_update(key);
+
+        return;
+}
@@ -0,0 +1,76 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/jump_label.h
+ *
+ * Header for static keys
+ *
+ */
+
+#ifndef JUMP_LABEL_H
+#define JUMP_LABEL_H                            1
+
+#include <stdint.h>
+
+#define JUMP_LABEL_NOP_SIZE                     5       /* same as jmp rel32 */
+
+/**
+ * struct static_key - a runtime switch that costs nothing while it's off
+ * @enabled: Current state; change it with static_key_enable()/disable()
+ */
+struct static_key {
+        int enabled;
+};
+
+#define STATIC_KEY_INIT_FALSE                   {0}
+
+/**
+ * struct jump_entry - one static_key_false() site, in the __jump_table section
+ * @code: Address of the nop that becomes a jmp
+ * @target: Where the jmp goes
+ * @key: Key it belongs to
+ */
+struct jump_entry {
+        uint64_t code;
+        uint64_t target;
+        uint64_t key;
+};
+
+void static_key_enable(struct static_key * key);
+void static_key_disable(struct static_key * key);
+
+#ifndef FRAGARIA_HOSTED
+/**
+ * static_key_false() - test a key that is usually off
+ * @key: Address of a struct static_key; must be a link time constant
+ *
+ * Emits a 5 byte nop that falls through to the off case, and records it in
+ * __jump_table so static_key_enable() can patch it into a jmp to the on
+ * case.  No load or compare on the fast path.  A macro rather than an inline
+ * function so the address stays an "i" operand without optimization.
+ *
+ * Return: nonzero if the key is on
+ */
+#define static_key_false(key)                                                  \
+        ({                                                                     \
+                __label__ jl_yes, jl_out;                                      \
+                int jl_ret;                                                    \
+                                                                               \
+                asm goto("1: .byte 0x0f, 0x1f, 0x44, 0x00, 0x00\n\t"          \
+                        ".pushsection __jump_table, \"aw\"\n\t"                \
+                        ".balign 8\n\t"                                        \
+                        ".quad 1b, %l[jl_yes], %c0\n\t"                        \
+                        ".popsection"                                          \
+                        : : "i"(key) : : jl_yes);                              \
+                jl_ret = 0;                                                    \
+                goto jl_out;                                                   \
+        jl_yes:                                                                \
+                jl_ret = 1;                                                    \
+        jl_out:                                                                \
+                jl_ret;                                                        \
+        })
+#else
+/* Hosted text isn't writable; fall back to testing the flag */
+#define static_key_false(key)   __builtin_expect((key)->enabled, 0)
+#endif
+
+#endif /* #ifndef JUMP_LABEL_H */
@@ -9,14 +9,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "checksum.h"
+#include "cpu.h"
+#include "fbcon.h"
+#include "fpu.h"
 #include "irq.h"
 #include "gdt.h"
 #include "kmalloc.h"
 #include "mm.h"
 #include "multiboot.h"
+#include "pit.h"
 #include "printk.h"
 #include "ps2.h"
 #include "serial.h"
+#include "trace.h"
 #include "vga.h"
 
 static void fault_handle_sp(int irq, uint32_t error, void * cr2, void * arg)
@@ -25,45 +31,96 @@ static void fault_handle_sp(int irq, uint32_t error, void * cr2, void * arg)
 
         asm("mov %%rsp, %0" : "=rm"(sp));
 
-        printk("Fault at %p, new sp: %p\n", cr2, sp);
+        pr_err("Fault at %p, new sp: %p\n", cr2, sp);
 
         return;
 }
 
+/**
+ * find_cmdline() - find the boot command line in the multiboot table
+ * @multiboot: Multiboot2 table
+ *
+ * Return: the command line, or an empty string if there isn't one
+ */
+static const char * find_cmdline(struct multiboot_table_header * multiboot)
+{
+        for (int i = 8; i < multiboot->total_size;) {
+                struct multiboot_header * current = 
+                        (struct multiboot_header *)((uint8_t *)multiboot + i);
+
+                if (current->type == 0)
+                        break;
+                else if (current->type == MULTIBOOT_CMDLINE)
+                        return ((struct multiboot_cmd_line *)current)->string;
+
+                i += (current->size + 7) & 0xFFFFFFF8;
+        }
+
+        return "";
+}
+
 void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
 {
+        /* Before anything calls memcpy/memset, they pick paths off this */
+        CPU_init();
+        FPU_init();
+        CSUM_init();
+
+        /* In a graphics mode text mode output can't be seen, and writing
+         * 0xB8000 or the CRTC could upset the display; output goes to serial
+         * until FB_init() takes over and shows it again.  The table is only
+         * worth reading if a multiboot loader left it. */
+        if (magic == MULTIBOOT_MAGIC && FB_probe(multiboot))
+                VGA_disable();
+
         VGA_clear();
-        printk("fragaria starting\n\n");
+        pr_info("fragaria starting\n\n");
 
         if(magic != MULTIBOOT_MAGIC) {
-                printk("Started from non-multiboot bootloader...\nstopping.");
+                pr_emerg("Started from non-multiboot bootloader...\nstopping.");
+                printk_flush();
                 asm("hlt");
         }
 
+        /* loglevel=N, trace=EVENT,... and friends */
+        printk_cmdline(find_cmdline(multiboot));
+        trace_cmdline(find_cmdline(multiboot));
+
         IRQ_set_handler(0x08, fault_handle_sp, NULL);   /* DF */
         IRQ_set_handler(0x0D, fault_handle_sp, NULL);   /* GP */
-        printk("TSS test handlers intialized\n");
+        pr_info("TSS test handlers intialized\n");
 
         GDT_init();
-        printk("New GDT initialized\n");
+        pr_info("New GDT initialized\n");
 
         IRQ_init();
-        printk("Interrupts setup\n");
+        pr_info("Interrupts setup\n");
 
         ps2_init();
-        printk("PS2 initialized\n");
+        pr_info("PS2 initialized\n");
 
         SER_init();
         SER_write("serial test\n", 13);
-        printk("Serial initialized\n");
+        pr_info("Serial initialized\n");
+
+        /* From here on printk() just queues, and the tick prints */
+        PIT_init();
+        printk_async();
+        pr_info("Timer initialized\n");
 
         MM_init(multiboot); 
 
+        /* Fill the atomic pool before any driver can ask it for memory */
+        kmalloc_atomic_refill();
+
+        if (FB_probe(multiboot) && FB_init(multiboot))
+                pr_warn("Framebuffer console failed, output on serial only\n");
+
         /* Test heap allocator and demand paging */
         {
                 void * heap = MMU_alloc_pages(16);
 
-                printk("heap at %p\n", heap);
+                pr_debug("heap at %p\n", heap);
 
                 for (int i = 0; i < 4096; i++) {
                         ((uint64_t *)heap)[i] = i;
@@ -71,7 +128,7 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
 
                 for (int i = 0; i < 4096; i++) {
                         if (((uint64_t *)heap)[i] != i)
-                                printk("Virtual memory error!\n");
+                                pr_err("Virtual memory error!\n");
                 }
 
                 MMU_free_page(heap);
@@ -81,7 +138,7 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
         {
                 void * heap = MMU_alloc_pages(16);
 
-                printk("heap at %p\n", heap);
+                pr_debug("heap at %p\n", heap);
 
                 for (int i = 0; i < 4096; i++) {
                         ((uint64_t *)heap)[i] = i;
@@ -89,20 +146,24 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
 
                 for (int i = 0; i < 4096; i++) {
                         if (((uint64_t *)heap)[i] != i)
-                                printk("Virtual memory error!\n");
+                                pr_err("Virtual memory error!\n");
                 }
 
                 MMU_free_page(heap);
         }
         
+#ifdef KMALLOC_LEAKCHECK
+        uint32_t epoch = kmalloc_leak_mark();
+#endif
+
         /* Test simple malloc */
         {
                 void * ptr;
 
                 if (!(ptr = kmalloc(100))) {
-                        printk("malloc failed\n");
+                        pr_err("malloc failed\n");
                 } else {
-                        printk("malloc returned %p\n", ptr);
+                        pr_debug("malloc returned %p\n", ptr);
 
                         for (int i = 0; i < 100; i++) {
                                 ((uint8_t *)ptr)[i] = i;
@@ -110,7 +171,7 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
 
                         for (int i = 0; i < 100; i++) {
                                 if(((uint8_t *)ptr)[i] != i)
-                                        printk("kmalloc error\n");
+                                        pr_err("kmalloc error\n");
                         }
                 }
 
@@ -133,7 +194,7 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
                 for (int i = 0; i < 256; i++) {
                         for (int j = 0; j < 100; j++) {
                                 if (arrays[i][j] != i)
-                                        printk("kmalloc error\n");
+                                        pr_err("kmalloc error\n");
                         }
 
                         if (i % 2 == 0)
@@ -159,7 +220,7 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
                 for (int i = 0; i < 256; i++) {
                         for (int j = 0; j < 10; j++) {
                                 if (arrays[i][j] != (i * 10) % 255)
-                                        printk("kmalloc error!\n");
+                                        pr_err("kmalloc error!\n");
                         }
 
                         kfree(arrays[i]);
@@ -178,18 +239,32 @@ void kmain(uint32_t magic, struct multiboot_table_header * multiboot)
 
                 for (int i = 0; i < 131072; i++) {
                         if (ptr[i] != i)
-                                printk("kmalloc error!\n");
+                                pr_err("kmalloc error!\n");
                 }
 
                 kfree(ptr);
         }
 
+        /* Everything above got freed again, so nothing should be left */
+        kmalloc_stats_dump();
+
+#ifdef KMALLOC_LEAKCHECK
+        kmalloc_leak_dump(epoch);
+#endif
+
+#ifdef KMALLOC_TRACE
+        kmalloc_trace_dump();
+#endif
+
         /* Unmask keyboard */
         IRQ_clear_mask(PIC_KEYBOARD);
-        printk("Keyboard unmasked: ");
+        pr_info("Keyboard unmasked: ");
 
-        while(1)
+        /* Hotkeys that take too long for the keyboard handler run here */
+        while(1) {
                 asm("hlt");
+                trace_poll();
+        }
 
         return;
 }
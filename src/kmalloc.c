@@ -9,13 +9,130 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "cpu.h"
+#include "irq.h"
 #include "kmalloc.h"
 #include "mm.h"
 #include "printk.h"
+#include "string.h"
+#include "trace.h"
+
+#ifdef KMALLOC_TRACE
+/* The allocator below gets built under these names and the traced entry points
+ * at the bottom of the file wrap it.  Calls from inside the allocator go
+ * straight to the untraced versions so nothing is counted twice. */
+#define kcalloc untraced_kcalloc
+#define kmalloc untraced_kmalloc
+#define kfree untraced_kfree
+#define krealloc untraced_krealloc
+#define kmalloc_aligned untraced_kmalloc_aligned
+#define kmalloc_dma untraced_kmalloc_dma
+#define kmalloc_flags untraced_kmalloc_flags
+
+static void * kcalloc(size_t nmeb, size_t size);
+static void * kmalloc(size_t size);
+static void kfree(void * ptr);
+static void * krealloc(void * ptr, size_t size);
+static void * kmalloc_aligned(size_t size, size_t align);
+static void * kmalloc_dma(size_t size, void ** phys);
+static void * kmalloc_flags(size_t size, int flags);
+#endif
 
 void * bottom = NULL, * top = NULL;
 struct malloc_header * head = NULL;
 
+/* Large allocations; headers live on the heap, data in mapped regions */
+struct malloc_header * mapped_head = NULL;
+
+/* Everything from here up to top has never been written since it was demand
+ * paged in, so it still reads as zero */
+static void * untouched = NULL;
+
+/* Magazine layer; the depot is shared so it takes a lock, CPU caches don't */
+static struct malloc_cpu_cache caches[KMALLOC_NCPUS];
+static struct malloc_depot depot[MALLOC_CACHE_CLASSES];
+static volatile int depot_lock = 0;
+static struct malloc_magazine magazines[MALLOC_CACHE_CLASSES
+        * (2 * KMALLOC_NCPUS + MALLOC_DEPOT_SIZE)];
+
+/* Atomic pool; pages are populated in order from atomic_base and each one is
+ * carved into objects of a single class */
+static uint8_t * atomic_base = NULL;
+static int atomic_pages = 0;
+static uint8_t atomic_class[KMALLOC_ATOMIC_PAGES];
+static void * atomic_free[KMALLOC_ATOMIC_CLASSES];
+static int atomic_count[KMALLOC_ATOMIC_CLASSES];
+static volatile int atomic_low = 0;
+
+#ifdef KMALLOC_LEAKCHECK
+/* Epoch new allocations get tagged with; 0 is kept for internal blocks */
+static uint32_t leak_epoch = 1;
+#endif
+
+/**
+ * tag_block() - note the leak check epoch a block got handed out in
+ * @hdr: Header of the block
+ *
+ * Return: void
+ */
+static inline void tag_block(struct malloc_header * hdr)
+{
+#ifdef KMALLOC_LEAKCHECK
+        hdr->epoch = leak_epoch;
+#endif
+        return;
+}
+
+/**
+ * untag_block() - keep a block the allocator uses itself out of leak reports
+ * @ptr: Pointer returned by kmalloc()
+ *
+ * Return: void
+ */
+static inline void untag_block(void * ptr)
+{
+#ifdef KMALLOC_LEAKCHECK
+        ((struct malloc_header *)((uintptr_t)ptr - HEADER_ALIGNED_SIZE))->epoch
+                = 0;
+#endif
+        return;
+}
+
+/**
+ * cpu_id() - index of the CPU we're running on
+ *
+ * Return: Always 0 until more CPUs get brought up
+ */
+static inline int cpu_id(void)
+{
+        return 0;
+}
+
+static inline void spin_lock(volatile int * lock)
+{
+        while(__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+                asm volatile("pause");
+}
+
+static inline void spin_unlock(volatile int * lock)
+{
+        __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * touch() - note that memory up to end may have been written
+ * @end: One past the last byte that may have been written
+ *
+ * Return: void
+ */
+static void touch(void * end)
+{
+        if((uintptr_t)end > (uintptr_t)untouched)
+                untouched = end;
+
+        return;
+}
+
 /**
  * print_header() - prints all header data to stderr for debugging
  * @hdr: Pointer to header to print
@@ -24,19 +141,44 @@ struct malloc_header * head = NULL;
  */
 static void print_header(struct malloc_header * hdr)
 {
-        printk("kmalloc header at %p\n", (void *)hdr);
+        pr_debug("kmalloc header at %p\n", (void *)hdr);
 
         /* Print warning message if we're unaligned */
         if ((uintptr_t)hdr % MALLOC_ALIGNMENT)
-                printk("    WARNING: HEADER UNALIGNED\n");
+                pr_debug("    WARNING: HEADER UNALIGNED\n");
 
         /* Make sure we're not dereferencing NULL ptr */
         if (hdr) {
-                printk("    next: %p\n", (void *)hdr->next);
-                printk("    previous: %p\n", (void *)hdr->previous);
-                printk("    size: %lu\n", hdr->size);
-                printk("    status: %s\n", hdr->status?"ALLOCATED":"FREE");
-                printk("    data start: %p\n", (void *)hdr->start);
+                pr_debug("    next: %p\n", (void *)hdr->next);
+                pr_debug("    previous: %p\n", (void *)hdr->previous);
+                pr_debug("    size: %lu\n", hdr->size);
+                pr_debug("    status: %s\n", hdr->status?"ALLOCATED":"FREE");
+                pr_debug("    data start: %p\n", (void *)hdr->start);
+        }
+
+        return;
+}
+
+/**
+ * cache_init() - hand every CPU its magazines and fill the depot with empties
+ *
+ * Return: void
+ */
+static void cache_init()
+{
+        struct malloc_magazine * mag = magazines;
+
+        for(int c = 0; c < MALLOC_CACHE_CLASSES; c++) {
+                for(int cpu = 0; cpu < KMALLOC_NCPUS; cpu++) {
+                        caches[cpu].loaded[c] = mag++;
+                        caches[cpu].previous[c] = mag++;
+                }
+
+                for(int i = 0; i < MALLOC_DEPOT_SIZE; i++)
+                        depot[c].empty[i] = mag++;
+
+                depot[c].nfull = 0;
+                depot[c].nempty = MALLOC_DEPOT_SIZE;
         }
 
         return;
@@ -51,12 +193,13 @@ static int kmalloc_init()
 {
         /* Try allocating one chunk */
         bottom = MMU_alloc_pages(MALLOC_CHUNK_SIZE / MM_PF_SIZE);
-        printk("MALLOC: allocated %d pages\n", MALLOC_CHUNK_SIZE / MM_PF_SIZE);
+        pr_debug("MALLOC: allocated %d pages\n",
+                MALLOC_CHUNK_SIZE / MM_PF_SIZE);
 
         /* Check if allocation succeeded */
         if(bottom == MM_FRAME_EMPTY) {
                 bottom = NULL;
-                printk("KMALLOC: init failed\n");
+                pr_err("KMALLOC: init failed\n");
                 return -1;
         }
 
@@ -72,10 +215,10 @@ static int kmalloc_init()
                 head = bottom;
         }
 
-        printk("MALLOC: bottom at %p\n", bottom);
-        printk("MALLOC: top at %p\n", top);
-        printk("MALLOC: chunk size: %d\n", MALLOC_CHUNK_SIZE);
-        printk("MALLOC: hdr size: %lu\n", sizeof(struct malloc_header));
+        pr_debug("MALLOC: bottom at %p\n", bottom);
+        pr_debug("MALLOC: top at %p\n", top);
+        pr_debug("MALLOC: chunk size: %d\n", MALLOC_CHUNK_SIZE);
+        pr_debug("MALLOC: hdr size: %lu\n", sizeof(struct malloc_header));
                 
         /* Initialize the first block as free */
         head->next = NULL;
@@ -84,12 +227,134 @@ static int kmalloc_init()
         head->start = (void *)((uintptr_t)head + HEADER_ALIGNED_SIZE);
         head->size = (uint8_t *)top - (uint8_t *)head->start;
 
-        printk("MALLOC: base header created:\n");
+        untouched = head->start;
+
+        cache_init();
+
+        pr_debug("MALLOC: base header created:\n");
         print_header(head);
 
         return 0;
 }
 
+/**
+ * merge_next() - absorb the following block into this one
+ * @current: Header of the block to grow
+ *
+ * Return: void
+ */
+static void merge_next(struct malloc_header * current)
+{
+        struct malloc_header * next = current->next;
+
+        current->size += next->size + HEADER_ALIGNED_SIZE;
+        current->next = next->next;
+        if(current->next)
+                current->next->previous = current;
+
+        return;
+}
+
+/**
+ * grow_heap() - move the break up so a free block of size fits at the end
+ * @last: Header of the last block on the heap
+ * @size: Minimum size of free block needed
+ *
+ * Grows by whole pages plus a chunk of slack so top stays page aligned.  A
+ * free last block gets extended, otherwise a new free block goes at the old
+ * top.
+ *
+ * Return: Pointer to the header of the free last block, NULL on failure
+ */
+static struct malloc_header * grow_heap(struct malloc_header * last,
+        size_t size)
+{
+        struct malloc_header * new_header;
+        size_t need, pages;
+
+        if(last->status == FREE)
+                need = size - last->size;
+        else
+                need = size + HEADER_ALIGNED_SIZE;
+
+        pages = (need + MALLOC_CHUNK_SIZE + MM_PF_SIZE - 1) / MM_PF_SIZE;
+
+        pr_debug("MALLOC: no block large enough, moving break %lu pages\n",
+                pages);
+
+        if(MMU_alloc_pages(pages) != top) {
+                pr_warn_ratelimited("MALLOC: failed to get more memory\n");
+
+                return NULL;
+        }
+
+        if(last->status == FREE) {
+                last->size += pages * MM_PF_SIZE;
+        } else {
+                new_header = top;
+
+                new_header->next = NULL;
+                new_header->previous = last;
+                last->next = new_header;
+
+                new_header->status = FREE;
+                new_header->start = (void *)((uintptr_t)new_header
+                                + HEADER_ALIGNED_SIZE);
+                new_header->size = pages * MM_PF_SIZE - HEADER_ALIGNED_SIZE;
+                touch(new_header->start);
+
+                last = new_header;
+        }
+
+        top = (void *)((uintptr_t)top + pages * MM_PF_SIZE);
+        trace(HEAP_GROW, pages, (uint64_t)top);
+
+        pr_debug("MALLOC: new top at %p\n", top);
+
+        return last;
+}
+
+/**
+ * trim_heap() - give whole pages at the end of the heap back
+ * @last: Header of a block that may be the free last block
+ *
+ * Only trims once the free tail passes MALLOC_TRIM_THRESHOLD, and then keeps
+ * MALLOC_TRIM_RESERVE of it mapped so alternating alloc/free bursts don't
+ * fault pages in and out over and over.
+ *
+ * Return: void
+ */
+static void trim_heap(struct malloc_header * last)
+{
+        uintptr_t new_top;
+
+        if(last->next || last->status != FREE
+                        || last->size <= MALLOC_TRIM_THRESHOLD)
+                return;
+
+        new_top = ((uintptr_t)last->start + MALLOC_TRIM_RESERVE
+                        + MM_PF_SIZE - 1) & ~(uintptr_t)(MM_PF_SIZE - 1);
+
+        if(new_top >= (uintptr_t)top)
+                return;
+
+        pr_debug("MALLOC: returning %lu pages\n",
+                ((uintptr_t)top - new_top) / MM_PF_SIZE);
+
+        /* Move the break down; the freed pages come back as fresh zero pages */
+        MMU_free_page((void *)new_top);
+
+        trace(HEAP_TRIM, ((uintptr_t)top - new_top) / MM_PF_SIZE, new_top);
+
+        last->size = new_top - (uintptr_t)last->start;
+        top = (void *)new_top;
+
+        if((uintptr_t)untouched > new_top)
+                untouched = top;
+
+        return;
+}
+
 /**
  * get_block() - find the first free block that fits 
  * @size: Minmum size of block to find
@@ -114,30 +379,7 @@ static struct malloc_header * get_block(size_t size)
         }
 
         /* If we get here, there's no free block big enough, so move break */
-        printk("MALLOC: no block large enough, moving break\n");
-        print_header(current);
-
-        /* get enough memory + some(64k) */
-        if(MMU_alloc_pages((size - current->size + MALLOC_CHUNK_SIZE)
-                        / MM_PF_SIZE) == MM_FRAME_EMPTY) {
-                printk("MALLOC: failed to get more memory\n");
-
-                return NULL;
-        }
-
-        /* Update top and current->size */
-        top = (void *)((uintptr_t)top
-                        + size
-                        - current->size
-                        + MALLOC_CHUNK_SIZE);
-
-        current->size = size + MALLOC_CHUNK_SIZE;
-
-        printk("MALLOC: new top at %p\n", top);
-        printk("MALLOC: new top header:\n");
-        print_header(current);
-
-        return current;
+        return grow_heap(current, size);
 }
 
 /**
@@ -162,370 +404,1506 @@ static struct malloc_header * find_header(void * ptr)
 }
 
 /**
- * calloc() - allocate a block of memory and initialize to zeroes
- * @nmeb: Number of members to make space for
- * @size: Size of each member
+ * split_block() - split the unused tail of a block off as a new free block
+ * @current: Header of the block to split
+ * @size: Number of bytes the block needs to keep
  *
- * Return: void * Pointer to allocated memory, NULL on fail
+ * Nothing happens if the tail can't fit an aligned header and one alignment
+ * unit of data.
+ *
+ * Return: void
  */
-void * kcalloc(size_t nmeb, size_t size)
+static void split_block(struct malloc_header * current, size_t size)
 {
-        void * ptr;
-        int i;
-       
-        ptr = kmalloc(nmeb * size);
+        struct malloc_header * new_header;
+        size_t keep = size + MALLOC_ALIGNMENT - (size % MALLOC_ALIGNMENT);
 
-        if(!ptr)
-                return NULL;
+        if(current->size < keep + HEADER_ALIGNED_SIZE + MALLOC_ALIGNMENT)
+                return;
 
-        for(i = 0; i < nmeb * size; i++)
-                ((uint8_t *)ptr)[i] = 0;
+        new_header = (void *)((uintptr_t)current->start + keep);
 
-        return ptr;
+        /* Link into list of headers */
+        new_header->next = current->next;
+        new_header->previous = current;
+        if(current->next)
+                current->next->previous = new_header;
+        current->next = new_header;
+
+        /* Set new header values */
+        new_header->status = FREE;
+        new_header->size = current->size - keep - HEADER_ALIGNED_SIZE;
+        new_header->start = (void *)((uintptr_t)new_header
+                        + HEADER_ALIGNED_SIZE);
+        touch(new_header->start);
+
+        current->size = keep;
+
+        return;
 }
 
 /**
- * kmalloc() - allocate a block of memory
- * @size: Number of bytes to allocate
+ * is_mapped() - check if a pointer belongs to a large mapped allocation
+ * @ptr: Pointer to check
  *
- * Return: void * Pointer to allocated memory, NULL on fail
+ * Return: nonzero if ptr is in the mapped region address range
  */
-void * kmalloc(size_t size)
+static int is_mapped(void * ptr)
 {
-        struct malloc_header * current;
-
-        if(!top) kmalloc_init();
-
-        /* Find a canidate header */
-        current = get_block(size);
-
-        /* If get_block returns null, break move failed and we're out of mem */
-        if(!current)
-                return NULL;
-
-        /* Mark block as allocated */
-        current->status = ALLOCATED;
+        return (uintptr_t)ptr >= MM_VMAP_BASE && (uintptr_t)ptr < MM_VMAP_END;
+}
 
-        /* Determine if it makes sense to put a new block (if we have space
-         * for an aligned header and one block */
-        if(current->size - size >= HEADER_ALIGNED_SIZE + MALLOC_ALIGNMENT) {
-                /* Split off a free block */
-                struct malloc_header * new_header;
+/**
+ * find_mapped() - find the header for the mapped region containing a pointer
+ * @ptr: Pointer to somewhere in the mapped region
+ *
+ * Return: Pointer to the header of that region, NULL on failure
+ */
+static struct malloc_header * find_mapped(void * ptr)
+{
+        struct malloc_header * current, * past = NULL;
 
-                new_header = (void *)((uintptr_t)current
-                                + HEADER_ALIGNED_SIZE
-                                + size
-                                + MALLOC_ALIGNMENT
-                                - size % MALLOC_ALIGNMENT);
+        for(current = mapped_head; current; current = current->next) {
+                if((uintptr_t)ptr >= (uintptr_t)current->start &&
+                   (uintptr_t)ptr < (uintptr_t)current->start
+                        + (uintptr_t)current->size)
+                        return current;
 
-                /* Link into list of headers */
-                new_header->next = current->next;
-                current->next = new_header;
-                new_header->previous = current;
+                /* Regions can sit back to back, so one past the end only
+                 * counts if no region actually contains ptr */
+                if((uintptr_t)ptr == (uintptr_t)current->start
+                                + (uintptr_t)current->size)
+                        past = current;
+        }
 
-                /* Set new header values */
-                new_header->status = FREE;
-                new_header->size = current->size
-                                - HEADER_ALIGNED_SIZE
-                                - size
-                                - MALLOC_ALIGNMENT
-                                + (size % MALLOC_ALIGNMENT);
-                new_header->start = (void *)((uintptr_t)new_header
-                                + HEADER_ALIGNED_SIZE);
+        return past;
+}
 
-                /* Update the size of the allocated block(make sure it's
-                 * aligned to a alignment block) */
-                current->size = size
-                        + MALLOC_ALIGNMENT
-                        - (size % MALLOC_ALIGNMENT);
-        }
+/**
+ * link_mapped() - add a header to the front of the mapped list
+ * @current: Header of the mapped region
+ *
+ * Return: void
+ */
+static void link_mapped(struct malloc_header * current)
+{
+        current->status = MAPPED;
+        tag_block(current);
+        current->previous = NULL;
+        current->next = mapped_head;
+        if(mapped_head)
+                mapped_head->previous = current;
+        mapped_head = current;
 
-        return current->start;
+        return;
 }
 
 /**
- * kfree() - free allocated memory
- * @ptr: Pointer to anywhere in the allocated block
+ * kmalloc_mapped() - allocate a large block in its own mapped region
+ * @size: Number of bytes to allocate
+ * @align: Alignment of the returned pointer, at least MM_PF_SIZE
  *
- * Note: ptr can point to anywhere from the orignal returned pointer from
- *       malloc/realloc, up to one past the end of the requested space(to
- *       account for incrementing the pointer).
+ * The region is page aligned and demand paged, so nothing gets faulted in
+ * until it is touched.  Only the small header lives on the heap.
  *
- * Return: void
+ * Return: void * Pointer to allocated memory, NULL on fail
  */
-void kfree(void * ptr)
+static void * kmalloc_mapped(size_t size, size_t align)
 {
         struct malloc_header * current;
+        int pages = (size + MM_PF_SIZE - 1) / MM_PF_SIZE;
+        int extra = 0, lead;
+        void * base;
 
-        /* Check NULL ptr */
-        if(!ptr) {
-                printk("MALLOC: free(NULL)\n");
-                return;
-        }
-
-        /* Init library if not already done */
-        if(!top)
-                kmalloc_init();
+        /* Regions are always page aligned; for more, map extra and trim */
+        if(align > MM_PF_SIZE)
+                extra = align / MM_PF_SIZE - 1;
 
-        /* Find the header that corresponds to the block requested */
-        current = find_header(ptr);
+        if(!(current = kmalloc(sizeof(struct malloc_header))))
+                return NULL;
 
-        /* Just return if the provided pointer is invalid(and we haven't 
-         * already segfault'd */
-        if(!current)
-                return;
+        untag_block(current);
 
-        /* Mark block as free */
-        current->status = FREE;
+        base = MMU_map_region(pages + extra);
 
-        /* Combine forwards */
-        if(current->next && current->next->status == FREE) {
-                current->size += current->next->size + HEADER_ALIGNED_SIZE;
-                current->next = current->next->next;
+        if(base == MM_FRAME_EMPTY) {
+                pr_warn("MALLOC: failed to map %d pages\n", pages + extra);
+                kfree(current);
+                return NULL;
         }
 
-        /* Combine backwards */
-        if(current->previous && current->previous->status == FREE) {
-                current->previous->size += current->size + HEADER_ALIGNED_SIZE;
-                current->previous->next = current->next;
-                current = current->previous;
+        current->start = (void *)(((uintptr_t)base + align - 1)
+                        & ~(uintptr_t)(align - 1));
+
+        if(extra) {
+                lead = ((uintptr_t)current->start - (uintptr_t)base)
+                        / MM_PF_SIZE;
+
+                MMU_unmap_region(base, lead);
+                MMU_unmap_region((uint8_t *)current->start
+                                + pages * MM_PF_SIZE, extra - lead);
         }
 
-        /* Check if we're on the last block and need to give mem back to
-         * the operating system */
-        /* TODO: fix page alignment */
-        if(!current->next && current->size > MALLOC_CHUNK_SIZE) {
-                printk("MALLOC: trying to return mem\n");
+        current->size = (size_t)pages * MM_PF_SIZE;
+        link_mapped(current);
 
-                /* sbrk(MALLOC_CHUNK_SIZE - current->size) - calculate how much
-                 * to free and leave at least a chunk allocated */
+        return current->start;
+}
 
-                /* We should have the chunk size left over */
-                current->size = MALLOC_CHUNK_SIZE;
+/**
+ * kfree_mapped() - unmap a large block and drop its header
+ * @current: Header of the mapped region
+ *
+ * Return: void
+ */
+static void kfree_mapped(struct malloc_header * current)
+{
+        /* Unlink from the mapped list */
+        if(current->previous)
+                current->previous->next = current->next;
+        else
+                mapped_head = current->next;
 
-                /* Update the top */
-                top = (void *)((uintptr_t)top
-                                + MALLOC_CHUNK_SIZE
-                                - current->size);
+        if(current->next)
+                current->next->previous = current->previous;
 
-                /* Set new break to top */
-                MMU_free_page(top);
+        MMU_unmap_region(current->start, current->size / MM_PF_SIZE);
 
-                printk("MALLOC: new top at %p\n", top);
-                printk("MALLOC: new last block:\n");
-                print_header(current);
-        }
+        kfree(current);
 
         return;
 }
 
 /**
- * krealloc() - resize malloc'd memory block
- * @ptr: Pointer to anywhere in the allocated block
+ * krealloc_mapped() - resize a large mapped block
+ * @current: Header of the mapped region
  * @size: New size of block
  *
- * Return: void * Pointer to new location of allocated block
+ * Return: void * Pointer to new location of allocated block, NULL on fail
  */
-void * krealloc(void * ptr, size_t size)
+static void * krealloc_mapped(struct malloc_header * current, size_t size)
 {
-        struct malloc_header * current;
+        size_t pages = (size + MM_PF_SIZE - 1) / MM_PF_SIZE;
+        void * new_mem;
 
-        /* Check size */
-        if(size == 0) {
-                kfree(ptr);
-                return NULL;
-        }
+        /* Shrinking just unmaps the pages past the new end */
+        if(pages * MM_PF_SIZE <= current->size) {
+                MMU_unmap_region((uint8_t *)current->start
+                                + pages * MM_PF_SIZE,
+                        current->size / MM_PF_SIZE - pages);
+                current->size = pages * MM_PF_SIZE;
 
-        /* Check NULL ptr */
-        if(!ptr) {
-                printk("MALLOC: realloc(NULL, %lu)\t=> (ptr=NULL, size=0)\n", 
-                        size);
-                
-                return kmalloc(size);
+                return current->start;
         }
 
-        /* If library hasn't been init, we wont find anything to realloc */
-        if(!top)
-                return NULL;
-
-        /* Find the header that corresponds to the block requested */
-        current = find_header(ptr);
-
-        /* Return error if the provided pointer is invalid(and we haven't 
-         * already segfault'd */
-        if(!current)
-                return NULL;
+        /* Growing; try to take the pages right after us */
+        if(!MMU_extend_region(current->start, current->size / MM_PF_SIZE,
+                                pages)) {
+                current->size = pages * MM_PF_SIZE;
 
-        /* If they asked for the same size, we don't have to do anything */
-        if(size == current->size) {
                 return current->start;
         }
 
-        /* If the size is smaller, maybe put a new free block and try merge */
-        if(size < current->size) {
-                size_t newsize;
-
-                /* Calculate our new smaller size */
-                newsize = size
-                        + MALLOC_ALIGNMENT
-                        - (size % MALLOC_ALIGNMENT);
-
-                /* If we have enough space, */
-                if(current->size - newsize >
-                                HEADER_ALIGNED_SIZE + MALLOC_ALIGNMENT) {
-                        /* Make a new free block */
-
-
-                        /* Split off a free block */
-                        struct malloc_header * new_header;
-
-                        new_header = (void *)((uintptr_t)current
-                                        + HEADER_ALIGNED_SIZE
-                                        + size
-                                        + MALLOC_ALIGNMENT
-                                        - size % MALLOC_ALIGNMENT);
-
-                        /* Link into list of headers */
-                        new_header->next = current->next;
-                        current->next = new_header;
-                        new_header->previous = current;
-
-                        /* Set new header values */
-                        new_header->status = FREE;
-                        new_header->size = current->size
-                                        - HEADER_ALIGNED_SIZE
-                                        - size
-                                        - MALLOC_ALIGNMENT
-                                        + (size % MALLOC_ALIGNMENT);
-                        new_header->start = (void *)((uintptr_t)new_header
-                                        + HEADER_ALIGNED_SIZE);
-
-                        /* Update the size of the allocated block(make sure it's
-                         * aligned to a alignment block) */
-                        current->size = size
-                                + MALLOC_ALIGNMENT
-                                - (size % MALLOC_ALIGNMENT);
-
-                        /* Combine forwards */
-                        if(new_header->next &&
-                                        new_header->next->status == FREE) {
-                                new_header->size += new_header->next->size
-                                        + HEADER_ALIGNED_SIZE;
-
-                                new_header->next = new_header->next->next;
-                        }
+        /* Otherwise move our frames to a bigger range; no data gets copied */
+        new_mem = MMU_remap_region(current->start, current->size / MM_PF_SIZE,
+                pages);
 
-                        /* Check if we're on the last block and need to give
-                         * mem back to the operating system */
-                        /* TODO fix header size page alignment */
-                        if(!new_header->next &&
-                                        new_header->size > MALLOC_CHUNK_SIZE) {
-                                printk("MALLOC: trying to return mem\n");
-
-                                /* We should have the chunk size left over */
-                                new_header->size = MALLOC_CHUNK_SIZE;
+        if(new_mem == MM_FRAME_EMPTY)
+                return NULL;
 
-                                /* Update the top */
-                                top = (void *)((uintptr_t)top
-                                                + MALLOC_CHUNK_SIZE
-                                                - new_header->size);
+        current->start = new_mem;
+        current->size = pages * MM_PF_SIZE;
 
-                                /* Move the break to the new top */
-                                MMU_free_page(top);
+        return current->start;
+}
 
-                                printk("MALLOC: new top at %p\n", top);
-                                printk("MALLOC: new last block:\n");
-                                print_header(new_header);
-                        }
-                }
+/**
+ * heap_alloc() - allocate a block straight from the heap list
+ * @size: Number of bytes to allocate
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+static void * heap_alloc(size_t size)
+{
+        struct malloc_header * current;
+
+        /* Find a canidate header */
+        current = get_block(size);
+
+        /* If get_block returns null, break move failed and we're out of mem */
+        if(!current)
+                return NULL;
+
+        /* Mark block as allocated */
+        current->status = ALLOCATED;
+        tag_block(current);
+
+        /* Split off the rest as a free block if there is space for an aligned
+         * header and one block */
+        split_block(current, size);
+
+        touch((uint8_t *)current->start + current->size);
+
+        return current->start;
+}
+
+/**
+ * heap_free() - give a block back to the heap list
+ * @current: Header of the block to free
+ *
+ * Return: void
+ */
+static void heap_free(struct malloc_header * current)
+{
+        /* Mark block as free */
+        current->status = FREE;
+
+        /* Combine forwards */
+        if(current->next && current->next->status == FREE)
+                merge_next(current);
+
+        /* Combine backwards */
+        if(current->previous && current->previous->status == FREE) {
+                current = current->previous;
+                merge_next(current);
+        }
+
+        /* Give memory back if we're now a big enough free last block */
+        trim_heap(current);
+
+        return;
+}
+
+/**
+ * size_class() - magazine size class for a request
+ * @size: Number of bytes asked for, at most MALLOC_CACHE_MAX
+ *
+ * Return: Class index; class c holds blocks of MALLOC_CACHE_MIN << c bytes
+ */
+static int size_class(size_t size)
+{
+        if(size <= MALLOC_CACHE_MIN)
+                return 0;
+
+        return 64 - __builtin_clzl(size - 1) - __builtin_ctz(MALLOC_CACHE_MIN);
+}
+
+/**
+ * capacity_class() - magazine size class a freed block can serve
+ * @size: Capacity of the block
+ *
+ * Return: Largest class the block fits, -1 if it shouldn't be cached
+ */
+static int capacity_class(size_t size)
+{
+        int c;
+
+        if(size < MALLOC_CACHE_MIN)
+                return -1;
+
+        c = 63 - __builtin_clzl(size) - __builtin_ctz(MALLOC_CACHE_MIN);
+
+        return c < MALLOC_CACHE_CLASSES ? c : -1;
+}
+
+/**
+ * cache_alloc() - take a block of a size class from this CPU's magazines
+ * @c: Size class
+ *
+ * Falls back to a full magazine from the depot, then to filling half a
+ * magazine from the heap in one go.
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+static void * cache_alloc(int c)
+{
+        struct malloc_cpu_cache * cpu = caches + cpu_id();
+        struct malloc_magazine * mag;
+        uint8_t enable_ints = 0;
+        void * ret = NULL;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        if(!cpu->loaded[c]->rounds && cpu->previous[c]->rounds) {
+                mag = cpu->loaded[c];
+                cpu->loaded[c] = cpu->previous[c];
+                cpu->previous[c] = mag;
+        }
+
+        if(!cpu->loaded[c]->rounds) {
+                /* Both empty; trade previous for a full one from the depot */
+                spin_lock(&depot_lock);
+
+                if(depot[c].nfull) {
+                        depot[c].empty[depot[c].nempty++] = cpu->previous[c];
+                        cpu->previous[c] = cpu->loaded[c];
+                        cpu->loaded[c] = depot[c].full[--depot[c].nfull];
+                }
+
+                spin_unlock(&depot_lock);
+        }
+
+        mag = cpu->loaded[c];
+
+        /* Nothing cached anywhere, refill half a magazine from the heap. One
+         * byte under the class size rounds up to exactly the class size, so
+         * the blocks come back to this class when freed */
+        if(!mag->rounds) {
+                while(mag->rounds < MALLOC_MAGAZINE_SIZE / 2) {
+                        void * obj = heap_alloc((MALLOC_CACHE_MIN << c) - 1);
+
+                        if(!obj)
+                                break;
+
+                        ((struct malloc_header *)((uintptr_t)obj
+                                - HEADER_ALIGNED_SIZE))->status = CACHED;
+                        mag->objs[mag->rounds++] = obj;
+                }
+        }
+
+        if(mag->rounds) {
+                struct malloc_header * hdr;
+
+                ret = mag->objs[--mag->rounds];
+                hdr = (struct malloc_header *)((uintptr_t)ret
+                        - HEADER_ALIGNED_SIZE);
+                hdr->status = ALLOCATED;
+                tag_block(hdr);
+        }
+
+        if(enable_ints)
+                STI;
+
+        return ret;
+}
+
+/**
+ * cache_free() - put a freed block in this CPU's magazines
+ * @c: Size class the block can serve
+ * @current: Header of the block
+ *
+ * When both magazines are full the previous one goes to the depot; if the
+ * depot is full too, half a magazine goes back to the heap in one go.
+ *
+ * Return: void
+ */
+static void cache_free(int c, struct malloc_header * current)
+{
+        struct malloc_cpu_cache * cpu = caches + cpu_id();
+        struct malloc_magazine * mag;
+        uint8_t enable_ints = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        if(cpu->loaded[c]->rounds == MALLOC_MAGAZINE_SIZE
+                        && cpu->previous[c]->rounds < MALLOC_MAGAZINE_SIZE) {
+                mag = cpu->loaded[c];
+                cpu->loaded[c] = cpu->previous[c];
+                cpu->previous[c] = mag;
+        }
+
+        if(cpu->loaded[c]->rounds == MALLOC_MAGAZINE_SIZE) {
+                /* Both full; trade previous for an empty one from the depot */
+                spin_lock(&depot_lock);
+
+                if(depot[c].nempty) {
+                        depot[c].full[depot[c].nfull++] = cpu->previous[c];
+                        cpu->previous[c] = cpu->loaded[c];
+                        cpu->loaded[c] = depot[c].empty[--depot[c].nempty];
+                }
+
+                spin_unlock(&depot_lock);
+        }
+
+        mag = cpu->loaded[c];
+
+        /* Depot is full as well, drain half of this magazine to the heap */
+        if(mag->rounds == MALLOC_MAGAZINE_SIZE) {
+                while(mag->rounds > MALLOC_MAGAZINE_SIZE / 2) {
+                        heap_free((struct malloc_header *)((uintptr_t)
+                                mag->objs[--mag->rounds]
+                                - HEADER_ALIGNED_SIZE));
+                }
+        }
+
+        current->status = CACHED;
+        mag->objs[mag->rounds++] = current->start;
+
+        if(enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * is_atomic() - check if a pointer is in the populated part of the atomic pool
+ * @ptr: Pointer to check
+ *
+ * Return: 1 if it is, 0 if not
+ */
+static int is_atomic(void * ptr)
+{
+        return atomic_base && (uint8_t *)ptr >= atomic_base
+                && (uint8_t *)ptr < atomic_base + atomic_pages * MM_PF_SIZE;
+}
+
+/**
+ * atomic_grow() - carve another pool page into objects of a class
+ * @c: Class to add objects to
+ *
+ * Writing the freelist links faults the page in, so this can only run where
+ * page faults are allowed; after this the page never faults again.
+ *
+ * Return: 0 on success, -1 if the pool is used up
+ */
+static int atomic_grow(int c)
+{
+        size_t size = KMALLOC_ATOMIC_MIN << c;
+        int n = MM_PF_SIZE / size;
+        uint8_t * page;
+        uint8_t enable_ints = 0;
+
+        if(!atomic_base) {
+                void * base = MMU_map_region(KMALLOC_ATOMIC_PAGES);
+
+                if(base == MM_FRAME_EMPTY)
+                        return -1;
+
+                atomic_base = base;
+        }
+
+        if(atomic_pages >= KMALLOC_ATOMIC_PAGES)
+                return -1;
+
+        page = atomic_base + atomic_pages * MM_PF_SIZE;
+
+        /* Chain the objects first, outside the critical section */
+        for(int i = 0; i < n - 1; i++)
+                *(void **)(page + i * size) = page + (i + 1) * size;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        *(void **)(page + (n - 1) * size) = atomic_free[c];
+        atomic_free[c] = page;
+        atomic_count[c] += n;
+        atomic_class[atomic_pages++] = c;
+
+        if(enable_ints)
+                STI;
+
+        return 0;
+}
+
+/**
+ * kmalloc_atomic_refill() - top the atomic pool back up
+ *
+ * Must be called outside interrupt context, since it can fault in new pool
+ * pages. kmalloc() and kfree() call it when the pool has run low.
+ *
+ * Return: void
+ */
+void kmalloc_atomic_refill(void)
+{
+        atomic_low = 0;
+
+        for(int c = 0; c < KMALLOC_ATOMIC_CLASSES; c++) {
+                while(atomic_count[c] < 2 * KMALLOC_ATOMIC_LOW) {
+                        if(atomic_grow(c)) {
+                                pr_warn_ratelimited("MALLOC: atomic pool "
+                                        "exhausted\n");
+                                return;
+                        }
+                }
+        }
+
+        return;
+}
+
+/**
+ * atomic_alloc() - pop an object off the atomic pool
+ * @size: Number of bytes to allocate
+ *
+ * Never faults, never grows anything and never waits.
+ *
+ * Return: void * Pointer to allocated memory, NULL if the class is empty
+ */
+static void * atomic_alloc(size_t size)
+{
+        uint8_t enable_ints = 0;
+        void * ret;
+        int c = 0;
+
+        if(!size || size > KMALLOC_ATOMIC_MAX)
+                return NULL;
+
+        while((size_t)(KMALLOC_ATOMIC_MIN << c) < size)
+                c++;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        if((ret = atomic_free[c])) {
+                atomic_free[c] = *(void **)ret;
+                atomic_count[c]--;
+        }
+
+        /* Ask the next allocation outside interrupt context to refill */
+        if(atomic_count[c] < KMALLOC_ATOMIC_LOW)
+                atomic_low = 1;
+
+        if(enable_ints)
+                STI;
+
+        return ret;
+}
+
+/**
+ * atomic_release() - push an object back on the atomic pool
+ * @ptr: Pointer to anywhere in the object
+ *
+ * Return: void
+ */
+static void atomic_release(void * ptr)
+{
+        uint8_t * page = (uint8_t *)((uintptr_t)ptr & ~(MM_PF_SIZE - 1));
+        int c = atomic_class[(page - atomic_base) / MM_PF_SIZE];
+        size_t size = KMALLOC_ATOMIC_MIN << c;
+        void * obj = page + ((uint8_t *)ptr - page) / size * size;
+        uint8_t enable_ints = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        *(void **)obj = atomic_free[c];
+        atomic_free[c] = obj;
+        atomic_count[c]++;
+
+        if(enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * calloc() - allocate a block of memory and initialize to zeroes
+ * @nmeb: Number of members to make space for
+ * @size: Size of each member
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+void * kcalloc(size_t nmeb, size_t size)
+{
+        void * ptr, * fresh;
+        size_t total = nmeb * size;
+
+        /* Check for overflow */
+        if(size && total / size != nmeb)
+                return NULL;
+
+        /* Mapped regions are always fresh demand paged memory, which the page
+         * fault handler zeroes; leave them unpopulated */
+        if(total >= MALLOC_MAPPED_THRESHOLD)
+                return kmalloc(total);
+
+        if(!top)
+                kmalloc_init();
+
+        /* Remember where never written heap started before we take a block */
+        fresh = untouched;
+
+        ptr = kmalloc(total);
+
+        if(!ptr)
+                return NULL;
+
+        /* Only clear the part of the block that was in use before */
+        if((uintptr_t)ptr < (uintptr_t)fresh) {
+                if((uintptr_t)fresh - (uintptr_t)ptr < total)
+                        total = (uintptr_t)fresh - (uintptr_t)ptr;
+
+                memset(ptr, 0, total);
+        }
+
+        return ptr;
+}
+
+/**
+ * kmalloc() - allocate a block of memory
+ * @size: Number of bytes to allocate
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+void * kmalloc(size_t size)
+{
+        void * ret;
+
+        if(size >= MALLOC_MAPPED_THRESHOLD) {
+                ret = kmalloc_mapped(size, MM_PF_SIZE);
+                goto exit;
+        }
+
+        if(!top) kmalloc_init();
+
+        if(atomic_low && interrupts_enabled())
+                kmalloc_atomic_refill();
+
+        /* Small sizes try this CPU's magazine first */
+        if(size <= MALLOC_CACHE_MAX && (ret = cache_alloc(size_class(size))))
+                goto exit;
+
+        ret = heap_alloc(size);
+
+exit:
+        trace(KMALLOC, size, (uint64_t)ret,
+                (uint64_t)__builtin_return_address(0));
+
+        return ret;
+}
+
+/**
+ * kfree() - free allocated memory
+ * @ptr: Pointer to anywhere in the allocated block
+ *
+ * Note: ptr can point to anywhere from the orignal returned pointer from
+ *       malloc/realloc, up to one past the end of the requested space(to
+ *       account for incrementing the pointer).
+ *
+ * Return: void
+ */
+void kfree(void * ptr)
+{
+        struct malloc_header * current;
+        int c;
+
+        /* Check NULL ptr */
+        if(!ptr) {
+                pr_debug("MALLOC: free(NULL)\n");
+                return;
+        }
+
+        trace(KFREE, (uint64_t)ptr, (uint64_t)__builtin_return_address(0));
+
+        /* Atomic pool objects go straight back to their class */
+        if(is_atomic(ptr)) {
+                atomic_release(ptr);
+
+                if(atomic_low && interrupts_enabled())
+                        kmalloc_atomic_refill();
+
+                return;
+        }
+
+        /* Large blocks never live on the heap */
+        if(is_mapped(ptr)) {
+                if((current = find_mapped(ptr)))
+                        kfree_mapped(current);
+
+                return;
+        }
+
+        /* Init library if not already done */
+        if(!top)
+                kmalloc_init();
+
+        /* Find the header that corresponds to the block requested */
+        current = find_header(ptr);
+
+        /* Just return if the provided pointer is invalid(and we haven't 
+         * already segfault'd */
+        if(!current)
+                return;
+
+        /* Just return on a double free */
+        if(current->status != ALLOCATED)
+                return;
+
+        /* Small blocks go to this CPU's magazines */
+        if((c = capacity_class(current->size)) >= 0) {
+                cache_free(c, current);
+                return;
+        }
+
+        heap_free(current);
+
+        return;
+}
+
+/**
+ * krealloc() - resize malloc'd memory block
+ * @ptr: Pointer to anywhere in the allocated block
+ * @size: New size of block
+ *
+ * Return: void * Pointer to new location of allocated block
+ */
+void * krealloc(void * ptr, size_t size)
+{
+        struct malloc_header * current;
+
+        /* Check size */
+        if(size == 0) {
+                kfree(ptr);
+                return NULL;
+        }
+
+        /* Check NULL ptr */
+        if(!ptr) {
+                pr_debug("MALLOC: realloc(NULL, %lu)\t=> (ptr=NULL, size=0)\n", 
+                        size);
+                
+                return kmalloc(size);
+        }
+
+        /* Atomic pool objects have a fixed size; move out if it's too small */
+        if(is_atomic(ptr)) {
+                size_t have = KMALLOC_ATOMIC_MIN << atomic_class[
+                        ((uint8_t *)ptr - atomic_base) / MM_PF_SIZE];
+                void * ret;
+
+                if(size <= have)
+                        return ptr;
+
+                if(!(ret = kmalloc(size)))
+                        return NULL;
+
+                memcpy(ret, ptr, have);
+                atomic_release(ptr);
+
+                return ret;
+        }
+
+        /* Large blocks get resized in their own region */
+        if(is_mapped(ptr)) {
+                if(!(current = find_mapped(ptr)))
+                        return NULL;
+
+                return krealloc_mapped(current, size);
+        }
+
+        /* If library hasn't been init, we wont find anything to realloc */
+        if(!top)
+                return NULL;
+
+        /* Find the header that corresponds to the block requested */
+        current = find_header(ptr);
+
+        /* Return error if the provided pointer is invalid(and we haven't 
+         * already segfault'd */
+        if(!current || current->status != ALLOCATED)
+                return NULL;
+
+        /* If they asked for the same size, we don't have to do anything */
+        if(size == current->size) {
+                return current->start;
+        }
+
+        /* If the size is smaller, maybe put a new free block and try merge */
+        if(size < current->size) {
+                struct malloc_header * next = current->next;
+
+                split_block(current, size);
+
+                /* If we split, merge the new block forwards and trim */
+                if(current->next != next) {
+                        if(next && next->status == FREE)
+                                merge_next(current->next);
+
+                        trim_heap(current->next);
+                }
+
+                /* Return the begnning of the shrunk data block */
+                return current->start;
+        }
+
+        /* If the size is larger, check if the next block is free and will fit
+         * so we can just expand */
+        if(current->next && current->next->status == FREE &&
+           current->size + current->next->size + HEADER_ALIGNED_SIZE >= size) {
+                merge_next(current);
+                split_block(current, size);
+
+                touch((uint8_t *)current->start + current->size);
+
+                return current->start;
+        } else {
+                /* If we can't expand, look for a new place */
+
+                /* TODO: this is not *quite* the most efficient way to
+                 * do this, but it's close and its what I have time
+                 * for.  It would be better to mark the current block 
+                 * as free so it's considered for copy if the previous 
+                 * block is free.
+                 */
+
+                void * new_mem;
+
+                /* Get a block big enough */
+                new_mem = kmalloc(size);
+
+                if(!new_mem)
+                        return NULL;
+
+                /* Copy over all of the data */
+                memcpy(new_mem, current->start, current->size);
+
+                kfree(current->start);
+
+                return new_mem;
+        }
+}
+
+/**
+ * aligned_fit() - find where an aligned payload would go in a free block
+ * @current: Header of the free block
+ * @size: Number of bytes needed
+ * @align: Alignment of the payload
+ *
+ * A gap in front of the payload has to be big enough to stay behind as its own
+ * free block, so nothing is wasted.
+ *
+ * Return: Address of the payload, 0 if it doesn't fit
+ */
+static uintptr_t aligned_fit(struct malloc_header * current, size_t size,
+        size_t align)
+{
+        uintptr_t start = (uintptr_t)current->start;
+        uintptr_t payload = (start + align - 1) & ~(uintptr_t)(align - 1);
+
+        while(payload != start
+                        && payload - start < HEADER_ALIGNED_SIZE
+                                + MALLOC_ALIGNMENT)
+                payload += align;
+
+        if(payload + size > start + current->size)
+                return 0;
+
+        return payload;
+}
+
+/**
+ * kmalloc_aligned() - allocate a block of memory with a given alignment
+ * @size: Number of bytes to allocate
+ * @align: Alignment of the returned pointer, must be a power of two
+ *
+ * Small blocks come from the heap; any space in front of the aligned payload
+ * is left as a free block.  Large blocks or alignments over a page get a
+ * mapped region.  Free with kfree() as usual.
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+void * kmalloc_aligned(size_t size, size_t align)
+{
+        struct malloc_header * current, * aligned;
+        uintptr_t payload = 0;
+
+        /* Alignment has to be a power of two */
+        if(!align || (align & (align - 1)))
+                return NULL;
+
+        if(align <= MALLOC_ALIGNMENT)
+                return kmalloc(size);
+
+        if(size >= MALLOC_MAPPED_THRESHOLD || align > MM_PF_SIZE)
+                return kmalloc_mapped(size, align);
 
-                
-                /* Return the begnning of the shrunk data block */
-                return current->start;
-                
+        if(!top)
+                kmalloc_init();
+
+        /* Look for a free block the aligned payload already fits in */
+        for(current = head; current; current = current->next) {
+                if(current->status == FREE
+                                && (payload = aligned_fit(current, size, align)))
+                        break;
         }
 
-        /* If the size is larger, find a new place */
-        if(size > current->size) {
-                /* Check if the next block is free and will fit */
-                if(current->next &&
-                   current->next->status == FREE &&
-                   current->size + current->next->size + HEADER_ALIGNED_SIZE >=
-                                size) {
-                        /* We can just expand */
-                        if(current->size + HEADER_ALIGNED_SIZE
-                           + current->next->size - size >=
-                           HEADER_ALIGNED_SIZE + MALLOC_ALIGNMENT) {
-                                /* We can fit a free block */
-                                struct malloc_header * new_header;
-
-                                new_header = (void *)((uintptr_t)current
-                                        + HEADER_ALIGNED_SIZE
-                                        + size
-                                        + MALLOC_ALIGNMENT
-                                        - size % MALLOC_ALIGNMENT);
-
-                                /* Link into list of headers */
-                                new_header->next = current->next;
-                                current->next = new_header;
-                                new_header->previous = current;
-
-                                /* Set new header values */
-                                new_header->status = FREE;
-                                new_header->size = current->size
-                                                - HEADER_ALIGNED_SIZE
-                                                - size
-                                                - MALLOC_ALIGNMENT
-                                                + (size % MALLOC_ALIGNMENT);
-                                new_header->start = (void *)((uintptr_t)
-                                                new_header
-                                                + HEADER_ALIGNED_SIZE);
-
-                                 /* Update the size of the allocated block.
-                                  * Make sure it's aligned to a block */
-                                current->size = size
-                                        + MALLOC_ALIGNMENT
-                                        - (size % MALLOC_ALIGNMENT);
-
-                        } else {
-                                /* We cannot fit a free block */
-
-                                current->size += current->next->size
-                                        + HEADER_ALIGNED_SIZE;
-                                current->next = current->next->next;
-                        }
+        /* Otherwise get a block with room to slide the payload up */
+        if(!current) {
+                current = get_block(size + align + HEADER_ALIGNED_SIZE
+                                + MALLOC_ALIGNMENT);
+
+                if(!current)
+                        return NULL;
+
+                payload = aligned_fit(current, size, align);
+        }
+
+        /* Put a header in front of the payload, leaving the gap free */
+        if(payload != (uintptr_t)current->start) {
+                aligned = (void *)(payload - HEADER_ALIGNED_SIZE);
+
+                aligned->next = current->next;
+                aligned->previous = current;
+                if(current->next)
+                        current->next->previous = aligned;
+                current->next = aligned;
+
+                aligned->start = (void *)payload;
+                aligned->size = (uintptr_t)current->start + current->size
+                        - payload;
+                current->size = (uintptr_t)aligned
+                        - (uintptr_t)current->start;
+
+                current = aligned;
+        }
+
+        current->status = ALLOCATED;
+        tag_block(current);
+        split_block(current, size);
+        touch((uint8_t *)current->start + current->size);
+
+        return current->start;
+}
+
+/**
+ * kmalloc_dma() - allocate physically contiguous memory for device access
+ * @size: Number of bytes to allocate
+ * @phys: Filled in with the physical address of the block, may be NULL
+ *
+ * The block is page aligned, mapped uncached and not zeroed.  Free with
+ * kfree(); don't krealloc() it as new pages would not be contiguous.
+ *
+ * Return: void * Virtual address of allocated memory, NULL on fail
+ */
+void * kmalloc_dma(size_t size, void ** phys)
+{
+        struct malloc_header * current;
+        int pages = (size + MM_PF_SIZE - 1) / MM_PF_SIZE;
+        void * frames;
+
+        if(!size)
+                return NULL;
+
+        if(!(current = kmalloc(sizeof(struct malloc_header))))
+                return NULL;
+
+        untag_block(current);
+
+        frames = MM_pf_alloc_contig(pages);
+
+        if(frames == MM_FRAME_EMPTY) {
+                pr_warn("MALLOC: no %d contiguous frames for DMA\n", pages);
+                kfree(current);
+                return NULL;
+        }
+
+        current->start = MMU_map_frames(frames, pages);
+
+        if(current->start == MM_FRAME_EMPTY) {
+                for(int i = 0; i < pages; i++)
+                        MM_pf_free((uint8_t *)frames + i * MM_PF_SIZE);
+
+                kfree(current);
+                return NULL;
+        }
+
+        current->size = (size_t)pages * MM_PF_SIZE;
+        link_mapped(current);
+
+        if(phys)
+                *phys = frames;
+
+        return current->start;
+}
+
+/**
+ * kmalloc_flags() - allocate memory with allocation flags
+ * @size: Number of bytes to allocate
+ * @flags: KM_NOWAIT to take from the atomic pool, 0 for a normal kmalloc
+ *
+ * Return: void * Pointer to allocated memory, NULL on fail
+ */
+void * kmalloc_flags(size_t size, int flags)
+{
+        if(flags & KM_NOWAIT)
+                return atomic_alloc(size);
+
+        return kmalloc(size);
+}
+
+/**
+ * kmalloc_get_stats() - walk the heap and mapped lists and sum them up
+ * @stats: Filled in with the totals
+ *
+ * Return: void
+ */
+void kmalloc_get_stats(struct kmalloc_stats * stats)
+{
+        struct malloc_header * current;
+
+        memset(stats, 0, sizeof(*stats));
+
+        if(!top)
+                return;
+
+        stats->heap_bytes = (uintptr_t)top - (uintptr_t)bottom;
+
+        for(current = head; current; current = current->next) {
+                stats->header_bytes += HEADER_ALIGNED_SIZE;
+
+                switch(current->status) {
+                case FREE:
+                        stats->free_blocks++;
+                        stats->free_bytes += current->size;
+
+                        if(current->size > stats->largest_free)
+                                stats->largest_free = current->size;
+                        break;
+                case CACHED:
+                        stats->cached_blocks++;
+                        stats->cached_bytes += current->size;
+                        break;
+                default:
+                        stats->used_blocks++;
+                        stats->used_bytes += current->size;
+                        break;
+                }
+        }
+
+        for(current = mapped_head; current; current = current->next) {
+                stats->mapped_regions++;
+                stats->mapped_bytes += current->size;
+        }
+
+        if(stats->free_bytes)
+                stats->fragmentation = 100 - stats->largest_free * 100
+                        / stats->free_bytes;
+
+        return;
+}
+
+/**
+ * kmalloc_stats_dump() - print a short heap health summary
+ *
+ * Return: void
+ */
+void kmalloc_stats_dump(void)
+{
+        struct kmalloc_stats stats;
+
+        kmalloc_get_stats(&stats);
+
+        pr_info("MALLOC: heap %lu bytes, headers %lu\n", stats.heap_bytes,
+                stats.header_bytes);
+        pr_info("    used %lu blocks/%lu bytes, cached %lu/%lu\n",
+                stats.used_blocks, stats.used_bytes, stats.cached_blocks,
+                stats.cached_bytes);
+        pr_info("    free %lu blocks/%lu bytes, largest %lu, %u%% fragmented\n",
+                stats.free_blocks, stats.free_bytes, stats.largest_free,
+                stats.fragmentation);
+        pr_info("    mapped %lu regions/%lu bytes\n", stats.mapped_regions,
+                stats.mapped_bytes);
+
+        return;
+}
+
+#ifdef KMALLOC_LEAKCHECK
+/**
+ * kmalloc_leak_mark() - start a new leak check epoch
+ *
+ * Return: The new epoch; pass it to kmalloc_leak_dump() later to see what
+ *         got allocated since and is still around
+ */
+uint32_t kmalloc_leak_mark(void)
+{
+        return ++leak_epoch;
+}
+
+/**
+ * leak_report() - print one outstanding block if there's room left
+ * @hdr: Header of the block
+ * @n: Number of blocks reported so far
+ *
+ * Return: void
+ */
+static void leak_report(struct malloc_header * hdr, int n)
+{
+        if(n > KMALLOC_LEAK_REPORT)
+                return;
+
+        if(n == KMALLOC_LEAK_REPORT) {
+                pr_info("    ...\n");
+                return;
+        }
+
+#ifdef KMALLOC_TRACE
+        pr_info("    %p: %lu bytes, epoch %u, by %p\n", hdr->start, hdr->size,
+                hdr->epoch, hdr->caller);
+#else
+        pr_info("    %p: %lu bytes, epoch %u\n", hdr->start, hdr->size,
+                hdr->epoch);
+#endif
+
+        return;
+}
+
+/**
+ * kmalloc_leak_dump() - print blocks allocated since an epoch and not freed
+ * @since: Epoch from kmalloc_leak_mark()
+ *
+ * Return: void
+ */
+void kmalloc_leak_dump(uint32_t since)
+{
+        struct malloc_header * current;
+        size_t bytes = 0;
+        int n = 0;
+
+        pr_info("MALLOC LEAKS: outstanding since epoch %u\n", since);
+
+        for(current = top ? head : NULL; current; current = current->next) {
+                if(current->status != ALLOCATED || current->epoch < since)
+                        continue;
+
+                leak_report(current, n++);
+                bytes += current->size;
+        }
+
+        for(current = mapped_head; current; current = current->next) {
+                if(current->epoch < since)
+                        continue;
+
+                leak_report(current, n++);
+                bytes += current->size;
+        }
+
+        pr_warn("MALLOC LEAKS: %d blocks, %lu bytes\n", n, bytes);
+
+        return;
+}
+#endif
+
+#ifdef KMALLOC_TRACE
+#undef kcalloc
+#undef kmalloc
+#undef kfree
+#undef krealloc
+#undef kmalloc_aligned
+#undef kmalloc_dma
+#undef kmalloc_flags
+
+#define TRACE_ALLOC 0
+#define TRACE_FREE 1
+
+/**
+ * struct kmalloc_trace_event - one entry in the trace ring
+ * @tsc: Timestamp counter when the call returned
+ * @caller: Return address of the call
+ * @ptr: Block allocated or freed
+ * @size: Bytes asked for, or bytes given back on free
+ * @op: TRACE_ALLOC or TRACE_FREE
+ */
+struct kmalloc_trace_event {
+        uint64_t tsc;
+        void * caller;
+        void * ptr;
+        size_t size;
+        uint8_t op;
+};
+
+/**
+ * struct kmalloc_trace_site - totals for one allocating callsite
+ * @caller: Return address of the callsite, NULL for the overflow entry
+ * @allocs: Number of allocations made
+ * @frees: Number of those allocations freed so far
+ * @bytes: Total bytes ever asked for
+ * @live: Bytes currently allocated
+ */
+struct kmalloc_trace_site {
+        void * caller;
+        uint64_t allocs;
+        uint64_t frees;
+        uint64_t bytes;
+        int64_t live;
+};
+
+static struct kmalloc_trace_event trace_ring[KMALLOC_TRACE_RING];
+static uint64_t trace_events = 0;
+static struct kmalloc_trace_site trace_sites[KMALLOC_TRACE_SITES];
+static struct kmalloc_trace_site trace_other;
+
+/**
+ * trace_site() - find or claim the totals entry for a callsite
+ * @caller: Return address of the callsite
+ *
+ * Return: Pointer to the entry; the overflow entry once the table is full
+ */
+static struct kmalloc_trace_site * trace_site(void * caller)
+{
+        int i = ((uintptr_t)caller >> 4) % KMALLOC_TRACE_SITES;
+
+        for(int n = 0; n < KMALLOC_TRACE_SITES; n++) {
+                if(trace_sites[i].caller == caller)
+                        return trace_sites + i;
+
+                if(!trace_sites[i].caller) {
+                        trace_sites[i].caller = caller;
+                        return trace_sites + i;
+                }
+
+                i = (i + 1) % KMALLOC_TRACE_SITES;
+        }
+
+        return &trace_other;
+}
+
+/**
+ * trace_ring_add() - add an event to the trace ring
+ * @op: TRACE_ALLOC or TRACE_FREE
+ * @caller: Return address of the call
+ * @ptr: Block allocated or freed
+ * @size: Bytes asked for or given back
+ *
+ * Return: void
+ */
+static void trace_ring_add(uint8_t op, void * caller, void * ptr, size_t size)
+{
+        struct kmalloc_trace_event * e;
+
+        e = trace_ring + trace_events++ % KMALLOC_TRACE_RING;
+        e->tsc = rdtsc();
+        e->caller = caller;
+        e->ptr = ptr;
+        e->size = size;
+        e->op = op;
+
+        return;
+}
+
+/**
+ * trace_header() - find the header of an allocated block for tracing
+ * @ptr: Pointer to somewhere in the block
+ *
+ * Return: Pointer to the header, NULL if ptr isn't allocated
+ */
+static struct malloc_header * trace_header(void * ptr)
+{
+        struct malloc_header * hdr;
+
+        if(!ptr || is_atomic(ptr))
+                return NULL;
+
+        if(is_mapped(ptr))
+                hdr = find_mapped(ptr);
+        else if(top)
+                hdr = find_header(ptr);
+        else
+                hdr = NULL;
+
+        if(hdr && hdr->status != ALLOCATED && hdr->status != MAPPED)
+                return NULL;
+
+        return hdr;
+}
+
+/**
+ * trace_alloc() - account a successful allocation to its callsite
+ * @caller: Return address of the allocating call
+ * @ptr: Block returned to the caller
+ * @size: Bytes asked for
+ *
+ * Return: void
+ */
+static void trace_alloc(void * caller, void * ptr, size_t size)
+{
+        struct malloc_header * hdr;
+        struct kmalloc_trace_site * site;
+
+        if(!(hdr = trace_header(ptr)))
+                return;
+
+        hdr->caller = caller;
+        hdr->requested = size;
+
+        site = trace_site(caller);
+        site->allocs++;
+        site->bytes += size;
+        site->live += size;
+
+        trace_ring_add(TRACE_ALLOC, caller, ptr, size);
+
+        return;
+}
+
+/**
+ * trace_release() - account a block going away to the callsite that made it
+ * @caller: Return address of the freeing call
+ * @owner: Return address of the call that allocated the block
+ * @ptr: Block being freed
+ * @size: Bytes the block was allocated with
+ *
+ * Return: void
+ */
+static void trace_release(void * caller, void * owner, void * ptr, size_t size)
+{
+        struct kmalloc_trace_site * site = trace_site(owner);
 
-                        return current->start;
+        site->frees++;
+        site->live -= size;
 
-                } else {
-                        /* If we can't expand, look for a new place */
+        trace_ring_add(TRACE_FREE, caller, ptr, size);
 
-                        /* TODO: this is not *quite* the most efficient way to
-                         * do this, but it's close and its what I have time
-                         * for.  It would be better to mark the current block 
-                         * as free so it's considered for copy if the previous 
-                         * block is free.
-                         */
+        return;
+}
+
+void * kcalloc(size_t nmeb, size_t size)
+{
+        void * ret = untraced_kcalloc(nmeb, size);
+
+        trace_alloc(__builtin_return_address(0), ret, nmeb * size);
+
+        return ret;
+}
+
+void * kmalloc(size_t size)
+{
+        void * ret = untraced_kmalloc(size);
+
+        trace_alloc(__builtin_return_address(0), ret, size);
+
+        return ret;
+}
+
+void kfree(void * ptr)
+{
+        struct malloc_header * hdr = trace_header(ptr);
+
+        if(hdr)
+                trace_release(__builtin_return_address(0), hdr->caller, ptr,
+                        hdr->requested);
+
+        untraced_kfree(ptr);
+
+        return;
+}
+
+void * krealloc(void * ptr, size_t size)
+{
+        struct malloc_header * hdr = trace_header(ptr);
+        void * owner = NULL, * ret;
+        size_t old = 0;
+
+        /* The header may be gone or reused once krealloc returns */
+        if(hdr) {
+                owner = hdr->caller;
+                old = hdr->requested;
+        }
+
+        ret = untraced_krealloc(ptr, size);
+
+        /* On failure the old block is still there */
+        if(!ret && size)
+                return ret;
+
+        if(hdr)
+                trace_release(__builtin_return_address(0), owner, ptr, old);
+
+        trace_alloc(__builtin_return_address(0), ret, size);
+
+        return ret;
+}
 
-                        void * new_mem;
-                        int i;
+void * kmalloc_aligned(size_t size, size_t align)
+{
+        void * ret = untraced_kmalloc_aligned(size, align);
+
+        trace_alloc(__builtin_return_address(0), ret, size);
+
+        return ret;
+}
+
+void * kmalloc_dma(size_t size, void ** phys)
+{
+        void * ret = untraced_kmalloc_dma(size, phys);
+
+        trace_alloc(__builtin_return_address(0), ret, size);
+
+        return ret;
+}
+
+void * kmalloc_flags(size_t size, int flags)
+{
+        void * ret = untraced_kmalloc_flags(size, flags);
+
+        /* The pool isn't traced; it's used where the trace tables can't be */
+        if(!(flags & KM_NOWAIT))
+                trace_alloc(__builtin_return_address(0), ret, size);
+
+        return ret;
+}
+
+/**
+ * kmalloc_trace_dump() - print callsite totals and recent heap events
+ *
+ * Callsites are sorted by live bytes, then by number of allocations.
+ *
+ * Return: void
+ */
+void kmalloc_trace_dump(void)
+{
+        struct kmalloc_trace_site * sorted[KMALLOC_TRACE_SITES + 1];
+        uint64_t first;
+        int n = 0;
 
-                        /* Get a block big enough */
-                        new_mem = kmalloc(size);
+        for(int i = 0; i < KMALLOC_TRACE_SITES; i++) {
+                if(trace_sites[i].caller)
+                        sorted[n++] = trace_sites + i;
+        }
 
-                        if(!new_mem)
-                                return NULL;
+        if(trace_other.allocs)
+                sorted[n++] = &trace_other;
 
-                        /* Copy over all of the data */
-                        for(i = 0; i < current->size; i++)
-                                ((uint8_t *)new_mem)[i] = 
-                                        ((uint8_t *)current->start)[i];
+        /* Insertion sort; there are never many callsites */
+        for(int i = 1; i < n; i++) {
+                struct kmalloc_trace_site * c = sorted[i];
+                int j;
 
-                        kfree(current);
+                for(j = i; j > 0; j--) {
+                        if(sorted[j - 1]->live > c->live
+                                        || (sorted[j - 1]->live == c->live
+                                        && sorted[j - 1]->allocs >= c->allocs))
+                                break;
 
-                        return new_mem;
+                        sorted[j] = sorted[j - 1];
                 }
+
+                sorted[j] = c;
+        }
+
+        pr_info("MALLOC TRACE: %d callsites, %lu events\n", n, trace_events);
+
+        for(int i = 0; i < n; i++) {
+                pr_info("    %p: live %ld, allocs %lu, frees %lu, bytes %lu\n",
+                        sorted[i]->caller, sorted[i]->live,
+                        sorted[i]->allocs, sorted[i]->frees,
+                        sorted[i]->bytes);
+        }
+
+        first = trace_events > KMALLOC_TRACE_RING ?
+                trace_events - KMALLOC_TRACE_RING : 0;
+
+        pr_info("MALLOC TRACE: last %lu events\n", trace_events - first);
+
+        for(uint64_t i = first; i < trace_events; i++) {
+                struct kmalloc_trace_event * e;
+
+                e = trace_ring + i % KMALLOC_TRACE_RING;
+                pr_info("    %lu %s %p, %lu bytes, by %p\n", e->tsc,
+                        e->op == TRACE_ALLOC ? "alloc" : "free", e->ptr,
+                        e->size, e->caller);
         }
 
-        return NULL;
+        return;
 }
+#endif /* #ifdef KMALLOC_TRACE */
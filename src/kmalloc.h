@@ -16,17 +16,112 @@
 #define MALLOC_CHUNK_SIZE (1<<16)
 #define MALLOC_ALIGNMENT 16
 
+/* Free space at the end of the heap past the threshold gets given back, all
+ * but the reserve */
+#define MALLOC_TRIM_THRESHOLD (4 * MALLOC_CHUNK_SIZE)
+#define MALLOC_TRIM_RESERVE MALLOC_CHUNK_SIZE
+
+/* Requests at least this big get their own mapped region instead of a block
+ * on the heap */
+#define MALLOC_MAPPED_THRESHOLD MALLOC_CHUNK_SIZE
+
 #define HEADER_ALIGNED_SIZE \
 (sizeof(struct malloc_header) + MALLOC_ALIGNMENT -\
 (sizeof(struct malloc_header) % MALLOC_ALIGNMENT))
 
+/* Per-CPU magazines of free blocks for sizes 16 up to 1024 bytes */
+#define KMALLOC_NCPUS 1
+#define MALLOC_CACHE_CLASSES 7
+#define MALLOC_CACHE_MIN MALLOC_ALIGNMENT
+#define MALLOC_CACHE_MAX (MALLOC_CACHE_MIN << (MALLOC_CACHE_CLASSES - 1))
+#define MALLOC_MAGAZINE_SIZE 32
+#define MALLOC_DEPOT_SIZE 8
+#define MALLOC_CACHE_LINE 64
+
+/* Pre-faulted pool for allocations that can't fault or grow the heap, such as
+ * from interrupt handlers; sizes 32 up to 512 bytes */
+#define KM_NOWAIT 0x1
+#define KMALLOC_ATOMIC_CLASSES 5
+#define KMALLOC_ATOMIC_MIN 32
+#define KMALLOC_ATOMIC_MAX (KMALLOC_ATOMIC_MIN << (KMALLOC_ATOMIC_CLASSES - 1))
+#define KMALLOC_ATOMIC_PAGES 64
+#define KMALLOC_ATOMIC_LOW 16
+
+/* Leak check, build with KFLAGS=-DKMALLOC_LEAKCHECK to enable; blocks get
+ * tagged with the epoch they were allocated in */
+#define KMALLOC_LEAK_REPORT 32
+
+/* Allocation profiler, build with KFLAGS=-DKMALLOC_TRACE to enable */
+#define KMALLOC_TRACE_RING 256
+#define KMALLOC_TRACE_SITES 64
+
 #define FREE 0
 #define ALLOCATED 1
+#define MAPPED 2
+#define CACHED 3
+
+/**
+ * struct kmalloc_stats - heap health summary from kmalloc_get_stats()
+ * @heap_bytes: Size of the heap, bottom to top
+ * @used_blocks: Allocated heap blocks
+ * @used_bytes: Capacity of allocated heap blocks
+ * @free_blocks: Free heap blocks
+ * @free_bytes: Capacity of free heap blocks
+ * @largest_free: Capacity of the biggest free heap block
+ * @cached_blocks: Free blocks held in per-CPU magazines
+ * @cached_bytes: Capacity of blocks held in per-CPU magazines
+ * @mapped_regions: Large allocations in their own mapped region
+ * @mapped_bytes: Size of those regions
+ * @header_bytes: Heap space taken by block headers
+ * @fragmentation: External fragmentation in percent; how much of the free
+ *                 space is outside the largest free block
+ */
+struct kmalloc_stats {
+        size_t heap_bytes;
+        size_t used_blocks;
+        size_t used_bytes;
+        size_t free_blocks;
+        size_t free_bytes;
+        size_t largest_free;
+        size_t cached_blocks;
+        size_t cached_bytes;
+        size_t mapped_regions;
+        size_t mapped_bytes;
+        size_t header_bytes;
+        unsigned int fragmentation;
+};
 
 void * kcalloc(size_t nmeb, size_t size);
 void * kmalloc(size_t size);
 void kfree(void * ptr);
 void * krealloc(void * ptr, size_t size);
+void * kmalloc_aligned(size_t size, size_t align);
+void * kmalloc_dma(size_t size, void ** phys);
+void * kmalloc_flags(size_t size, int flags);
+void kmalloc_atomic_refill(void);
+
+/**
+ * kmalloc_atomic() - allocate from the pre-faulted pool, safe in interrupts
+ * @size: Number of bytes to allocate, at most KMALLOC_ATOMIC_MAX
+ *
+ * Return: void * Pointer to allocated memory, NULL if the pool is empty
+ */
+static inline void * kmalloc_atomic(size_t size)
+{
+        return kmalloc_flags(size, KM_NOWAIT);
+}
+
+void kmalloc_get_stats(struct kmalloc_stats * stats);
+void kmalloc_stats_dump(void);
+
+#ifdef KMALLOC_LEAKCHECK
+uint32_t kmalloc_leak_mark(void);
+void kmalloc_leak_dump(uint32_t since);
+#endif
+
+#ifdef KMALLOC_TRACE
+void kmalloc_trace_dump(void);
+#endif
 
 /* struct malloc_header requiremnts:
    - Next header: NULL on end
@@ -35,6 +130,8 @@ void * krealloc(void * ptr, size_t size);
    - Status(uint8)
            - 0: free
            - 1: allocated
+           - 2: mapped (large allocation outside the heap)
+           - 3: cached (free, but held in a per-CPU magazine)
    - Pointer to start of data
 */
 
@@ -43,8 +140,12 @@ void * krealloc(void * ptr, size_t size);
  * @next: Pointer to the next header, NULL if does not exist
  * @previous: Point to the previous header, NULL if does not exist
  * @size: Size of allocated data block(as requested by user)
- * @status: 0 if free, 1 if allocated
+ * @status: 0 if free, 1 if allocated, 2 if mapped, 3 if cached
  * @start: Pointer to start of data
+ * @epoch: Leak check epoch it was allocated in, 0 if internal
+ *          (KMALLOC_LEAKCHECK only)
+ * @caller: Return address of the call that allocated it (KMALLOC_TRACE only)
+ * @requested: Size asked for by that call (KMALLOC_TRACE only)
  */
 struct malloc_header {
         struct malloc_header * next;
@@ -52,6 +153,50 @@ struct malloc_header {
         size_t size;
         uint8_t status;
         void * start;
+#ifdef KMALLOC_LEAKCHECK
+        uint32_t epoch;
+#endif
+#ifdef KMALLOC_TRACE
+        void * caller;
+        size_t requested;
+#endif
+};
+
+/**
+ * struct malloc_magazine - stack of cached free blocks of one size class
+ * @rounds: Number of blocks in the magazine
+ * @objs: Data pointers of the cached blocks
+ */
+struct malloc_magazine {
+        int rounds;
+        void * objs[MALLOC_MAGAZINE_SIZE];
+} __attribute__((aligned(MALLOC_CACHE_LINE)));
+
+/**
+ * struct malloc_cpu_cache - magazines owned by one CPU
+ * @loaded: Magazine allocations and frees use first, per class
+ * @previous: Magazine swapped in when loaded runs empty or full, per class
+ *
+ * Only the owning CPU touches these, with interrupts off; each CPU's cache
+ * sits on its own cache lines.
+ */
+struct malloc_cpu_cache {
+        struct malloc_magazine * loaded[MALLOC_CACHE_CLASSES];
+        struct malloc_magazine * previous[MALLOC_CACHE_CLASSES];
+} __attribute__((aligned(MALLOC_CACHE_LINE)));
+
+/**
+ * struct malloc_depot - magazines shared between CPUs for one size class
+ * @full: Full magazines ready to hand to a CPU
+ * @empty: Empty magazines ready to take a CPU's frees
+ * @nfull: Number of full magazines
+ * @nempty: Number of empty magazines
+ */
+struct malloc_depot {
+        struct malloc_magazine * full[MALLOC_DEPOT_SIZE];
+        struct malloc_magazine * empty[MALLOC_DEPOT_SIZE];
+        int nfull;
+        int nempty;
 };
 
 #endif /* #ifndef KMALLOC_H */
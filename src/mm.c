@@ -9,10 +9,13 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "cpu.h"
 #include "irq.h"
 #include "mm.h"
 #include "multiboot.h"
 #include "printk.h"
+#include "string.h"
+#include "trace.h"
 
 /* Make space to store a static ammount of RAM regions from multiboot2.
  * We should only get 2 or maybe 3, there's space for 5. */
@@ -21,9 +24,18 @@ struct MM_unused unused[MM_RAM_REGIONS];
 struct MM_frame_list used;
 struct MM_frame_list freed;
 
+/* Page tables only exist in the kernel; the hosted build gets the MMU_*
+ * functions from its shim */
+#ifndef FRAGARIA_HOSTED
+
 /* Shared heap break between MMU_alloc_page() and MMU_alloc_pages() */
 static void * heap_break = (void *)(0x008000000000);
 
+/* Break and released ranges for MMU_map_region(), kept apart from the heap so
+ * large mappings never get in the way of the contiguous kernel heap */
+static void * vmap_break = (void *)MM_VMAP_BASE;
+static struct MM_vmap_hole vmap_holes[MM_VMAP_HOLES];
+
 /**
  * resolve_virt_addr() - Walk the page table for a virtual address
  * @table Pointer to start of PML4 table
@@ -55,14 +67,13 @@ static struct pt * resolve_virt_addr(struct pml4 * table, void * virt_addr)
         } else {
                 p3_table = MM_pf_alloc();
 
-                printk("Allocating new P3 table at P4[%d]\n", p4_index);
+                pr_debug("Allocating new P3 table at P4[%d]\n", p4_index);
 
                 if (p3_table == MM_FRAME_EMPTY)
                         return MM_FRAME_EMPTY;
 
-                for (int i = 0; i < MM_PF_SIZE / sizeof(struct pml4); i++) {
-                        p3_table[i].address = 0;
-                }
+                clear_page(p3_table);
+                trace(PT_ALLOC, 3, (uint64_t)p3_table);
 
                 table[p4_index].address = (uint64_t)p3_table & MM_ADDR_MASK;
                 table[p4_index].present = 1;
@@ -77,14 +88,13 @@ static struct pt * resolve_virt_addr(struct pml4 * table, void * virt_addr)
         } else {
                 p2_table = MM_pf_alloc();
 
-                printk("Allocating new P2 table at P3[%d]\n", p3_index);
+                pr_debug("Allocating new P2 table at P3[%d]\n", p3_index);
 
                 if (p2_table == MM_FRAME_EMPTY)
                         return MM_FRAME_EMPTY;
 
-                for (int i = 0; i < MM_PF_SIZE / sizeof(struct pml4); i++) {
-                        p2_table[i].address = 0;
-                }
+                clear_page(p2_table);
+                trace(PT_ALLOC, 2, (uint64_t)p2_table);
 
                 p3_table[p3_index].address = (uint64_t)p2_table & MM_ADDR_MASK;
                 p3_table[p3_index].present = 1;
@@ -99,14 +109,13 @@ static struct pt * resolve_virt_addr(struct pml4 * table, void * virt_addr)
         } else {
                 p1_table = MM_pf_alloc();
 
-                printk("Allocating new P1 table at P2[%d]\n", p2_index);
+                pr_debug("Allocating new P1 table at P2[%d]\n", p2_index);
 
                 if (p1_table == MM_FRAME_EMPTY)
                         return MM_FRAME_EMPTY;
 
-                for (int i = 0; i < MM_PF_SIZE / sizeof(struct pt); i++) {
-                        p1_table[i].address = 0;
-                }
+                clear_page(p1_table);
+                trace(PT_ALLOC, 1, (uint64_t)p1_table);
 
                 p2_table[p2_index].address = (uint64_t)p1_table & MM_ADDR_MASK;
                 p2_table[p2_index].present = 1;
@@ -133,14 +142,17 @@ static void pf_handle(int irq, uint32_t error, void * cr2, void * arg)
 
         asm("mov %%rsp, %0" : "=rm"(sp));
 
-        printk("Fault at %p, new sp: %p\n", cr2, sp);
+        trace(PAGE_FAULT, (uint64_t)cr2, error);
+
+        pr_debug("Fault at %p, new sp: %p\n", cr2, sp);
 
         pt = resolve_virt_addr(p4_table, cr2);
 
         /* Check if we should map this page into memory */
         if ((void *)pt == MM_FRAME_EMPTY || pt->present 
                         || pt->available != PT_TO_ALLOC) {
-                printk("Unhandled fault at %p!!!\nFATAL... STOPPING.\n", cr2);
+                pr_emerg("Unhandled fault at %p!!!\nFATAL... STOPPING.\n", cr2);
+                printk_flush();
                 asm("hlt");
         }
 
@@ -149,7 +161,8 @@ static void pf_handle(int irq, uint32_t error, void * cr2, void * arg)
         pt->address = (uint64_t)MM_pf_alloc();
 
         if ((void *)pt->address == MM_FRAME_EMPTY) {
-                printk("Out of memory!\nFATAL... STOPPING.\n");
+                pr_emerg("Out of memory!\nFATAL... STOPPING.\n");
+                printk_flush();
                 asm("hlt");
         }
 
@@ -169,9 +182,14 @@ static void pf_handle(int irq, uint32_t error, void * cr2, void * arg)
         pt->avl = saved.avl;
         pt->nx = saved.nx;
 
+        /* Hand out frames zeroed; kcalloc counts on fresh pages reading 0 */
+        clear_page((void *)((uint64_t)cr2 & ~(MM_PF_SIZE - 1)));
+
         return;
 }
 
+#endif /* #ifndef FRAGARIA_HOSTED */
+
 /**
  * MM_frame_list_contains() - Search frame list for a certain address 
  * @list to search 
@@ -205,7 +223,7 @@ static void ** MM_frame_list_add(struct MM_frame_list * list, void * addr)
 
         /* First make sure we're not putting a duplicate */
         if ((ret = MM_frame_list_contains(list, addr))) {
-                printk("Address %p already in table\n", addr);
+                pr_warn_ratelimited("Address %p already in table\n", addr);
                 return ret;
         }
 
@@ -246,7 +264,7 @@ static void ** MM_frame_list_add(struct MM_frame_list * list, void * addr)
 
         /* If list has no space but says it has space; fix and return null.
          * Theoretically we'll never get here... */
-        printk("List capcaity off by one!! FATAL\n");
+        pr_err("List capcaity off by one!! FATAL\n");
         list->num = MM_FRAME_LIST_CAPACITY;
 
         return NULL;
@@ -284,7 +302,7 @@ static void ** MM_frame_list_remove(struct MM_frame_list * list, void * addr)
 static void parse_elf(struct multiboot_elf_symbols * elf_symbols)
 {
         for (int i = 0; i < elf_symbols->num; i++) {
-                printk("    Section type %d, address %lx, size %ld\n",
+                pr_debug("    Section type %d, address %lx, size %ld\n",
                         elf_symbols->headers[i].sh_type,
                         elf_symbols->headers[i].sh_addr,
                         elf_symbols->headers[i].sh_size);
@@ -314,7 +332,7 @@ static void parse_mem_map(struct multiboot_mem_map * mm)
                         if (n >= MM_RAM_REGIONS)
                                 break;
 
-                        printk("RAM region at 0x%lx, %ld bytes\n",
+                        pr_info("RAM region at 0x%lx, %ld bytes\n",
                                 mm->entries[i].base_addr,
                                 mm->entries[i].length);
 
@@ -329,6 +347,35 @@ static void parse_mem_map(struct multiboot_mem_map * mm)
         return;
 }
 
+#ifndef FRAGARIA_HOSTED
+/* Whether MM_PAT_WC_ENTRY really is write combining */
+static int pat_wc = 0;
+
+/**
+ * pat_init() - make MM_PAT_WC_ENTRY write combining
+ *
+ * Nothing maps with the PAT bit before this, so no caches or TLBs hold the
+ * old type for that entry and there's nothing to flush.
+ *
+ */
+static void pat_init()
+{
+        uint64_t pat;
+
+        if (!CPU_has(CPU_PAT))
+                return;
+
+        pat = rdmsr(MSR_PAT);
+        pat &= ~(0xFFull << (8 * MM_PAT_WC_ENTRY));
+        pat |= (uint64_t)MM_PAT_WC << (8 * MM_PAT_WC_ENTRY);
+        wrmsr(MSR_PAT, pat);
+
+        pat_wc = 1;
+
+        return;
+}
+#endif /* #ifndef FRAGARIA_HOSTED */
+
 /**
  * MM_init() - Initialized memory mangement structures 
  *
@@ -354,8 +401,9 @@ void MM_init(struct multiboot_table_header * multiboot)
                 freed.addr[i] = MM_FRAME_EMPTY;
         }
 
-        printk("Found multiboot table at: %p\n", multiboot);
-        printk("    multiboot table length: %d bytes\n", multiboot->total_size);
+        pr_debug("Found multiboot table at: %p\n", multiboot);
+        pr_debug("    multiboot table length: %d bytes\n",
+                multiboot->total_size);
 
         /* Mark multiboot2 table as used */
         for(int i = 0; i < multiboot->total_size; i -= MM_PF_SIZE) {
@@ -382,9 +430,13 @@ void MM_init(struct multiboot_table_header * multiboot)
                 i += (current->size + 7) & 0xFFFFFFF8;
         }
 
+#ifndef FRAGARIA_HOSTED
         /* Init PF handler */
         IRQ_set_handler(EXCEPTION_PF, pf_handle, NULL);
 
+        pat_init();
+#endif
+
         return;
 }
 
@@ -415,6 +467,7 @@ void * MM_pf_alloc()
                                 c->num--;
 
                                 MM_frame_list_add(&used, attempt);
+                                trace(FRAME_ALLOC, (uint64_t)attempt);
 
                                 return attempt;
                         }
@@ -440,6 +493,8 @@ void * MM_pf_alloc()
                         if (unused[n].current < attempt + MM_PF_SIZE)
                                 unused[n].current = attempt + MM_PF_SIZE;
 
+                        trace(FRAME_ALLOC, (uint64_t)attempt);
+
                         return attempt;
                 }
         }
@@ -460,10 +515,200 @@ void MM_pf_free(void * pf)
         /* If given page was allocated, add it to free list*/
         if (MM_frame_list_remove(&used, pf) != MM_FRAME_EMPTY) {
                 MM_frame_list_add(&freed, pf);
+                trace(FRAME_FREE, (uint64_t)pf);
         } else {
-                printk("MM_pf_free() called on unallocated address %p!\n", pf);
+                pr_warn_ratelimited("MM_pf_free() called on unallocated "
+                        "address %p!\n", pf);
+        }
+
+        return;
+}
+
+/**
+ * mark_used() - Note which frames of a window are in the used list
+ * @base first frame of the window
+ * @bitmap one bit per frame, MM_CONTIG_WINDOW of them; gets overwritten
+ * 
+ */
+static void mark_used(void * base, uint64_t * bitmap)
+{
+        memset(bitmap, 0, MM_CONTIG_WINDOW / 8);
+
+        for (struct MM_frame_list * c = &used; c && c != MM_FRAME_EMPTY;
+                        c = c->next) {
+                for (int i = 0; i < MM_FRAME_LIST_CAPACITY; i++) {
+                        uint64_t f = (c->addr[i] - base) / MM_PF_SIZE;
+
+                        /* Catches MM_FRAME_EMPTY and frames below base too */
+                        if (c->addr[i] >= base && f < MM_CONTIG_WINDOW)
+                                bitmap[f / 64] |= (uint64_t)1 << (f % 64);
+                }
+        }
+
+        return;
+}
+
+/**
+ * MM_pf_alloc_contig() - Allocate physically contiguous page frames
+ * @n number of frames to allocate
+ * 
+ * Looks for the first run of frames not in the used list in each region,
+ * from its base, so frames freed earlier count too.  Each window of
+ * MM_CONTIG_WINDOW frames costs one pass over the used list rather than
+ * one per frame.  Still slow compared to MM_pf_alloc(), meant for the odd
+ * DMA buffer rather than general use.
+ * 
+ * @return void * physical address of the first frame; MM_FRAME_EMPTY on failure
+ */
+void * MM_pf_alloc_contig(int n)
+{
+        uint64_t bitmap[MM_CONTIG_WINDOW / 64];
+
+        if (n <= 0)
+                return MM_FRAME_EMPTY;
+
+        for (int r = 0; r < MM_RAM_REGIONS && unused[r].size; r++) {
+                void * end = unused[r].addr + unused[r].size;
+                void * base = NULL;
+                int run = 0;
+
+                for (void * window = unused[r].addr;
+                                window + MM_PF_SIZE <= end;
+                                window += MM_CONTIG_WINDOW * MM_PF_SIZE) {
+                        mark_used(window, bitmap);
+
+                        for (int f = 0; f < MM_CONTIG_WINDOW
+                                        && window + (f + 1) * MM_PF_SIZE
+                                                <= end; f++) {
+                                if (bitmap[f / 64] & (uint64_t)1 << (f % 64)) {
+                                        run = 0;
+                                        continue;
+                                }
+
+                                /* Runs carry on into the next window */
+                                if (run++ == 0)
+                                        base = window + f * MM_PF_SIZE;
+
+                                if (run == n)
+                                        goto found;
+                        }
+                }
+
+                continue;
+
+found:
+                /* Frames below unused[r].current that aren't used are on
+                 * the free list, so pull them off it too.
+                 * unused[r].current is left alone as MM_pf_alloc() already
+                 * skips used frames. */
+                for (int i = 0; i < n; i++) {
+                        MM_frame_list_remove(&freed, base + i * MM_PF_SIZE);
+                        MM_frame_list_add(&used, base + i * MM_PF_SIZE);
+                }
+
+                return base;
+        }
+
+        return MM_FRAME_EMPTY;
+}
+
+#ifndef FRAGARIA_HOSTED
+
+/**
+ * set_demand_page() - Mark a page table entry to be mapped on first touch
+ * @pt level 1 page table entry to set up
+ * 
+ */
+static void set_demand_page(struct pt * pt)
+{
+        pt->address = 0;
+        /* Don't actually map page until something writes to it */
+        pt->present = 0;
+        pt->rw = 1;
+        pt->pcd = 1;
+        pt->available = PT_TO_ALLOC;
+
+        return;
+}
+
+/**
+ * vmap_reserve() - Find n free virtual pages in the mapped region 
+ * @n number of pages to reserve
+ * 
+ * Reuses the first released range that fits before moving the mapped region
+ * break up.
+ * 
+ * @return void * base of reserved range, MM_FRAME_EMPTY on failure
+ */
+static void * vmap_reserve(int n)
+{
+        void * ret;
+
+        for (int i = 0; i < MM_VMAP_HOLES; i++) {
+                if (vmap_holes[i].n >= n) {
+                        ret = vmap_holes[i].addr;
+                        vmap_holes[i].addr += n * MM_PF_SIZE;
+                        vmap_holes[i].n -= n;
+
+                        return ret;
+                }
         }
 
+        if (vmap_break + n * MM_PF_SIZE > (void *)MM_VMAP_END)
+                return MM_FRAME_EMPTY;
+
+        ret = vmap_break;
+        vmap_break += n * MM_PF_SIZE;
+
+        return ret;
+}
+
+/**
+ * vmap_release() - Give a range of virtual pages back to the mapped region 
+ * @addr base of range to release
+ * @n number of pages in range
+ * 
+ * Only the addresses are released, page table entries must already be clear.
+ * 
+ */
+static void vmap_release(void * addr, int n)
+{
+        void * end = addr + n * MM_PF_SIZE;
+
+        /* Merge with released ranges on either side */
+        for (int i = 0; i < MM_VMAP_HOLES; i++) {
+                if (!vmap_holes[i].n)
+                        continue;
+
+                if (vmap_holes[i].addr + vmap_holes[i].n * MM_PF_SIZE
+                                == addr) {
+                        addr = vmap_holes[i].addr;
+                        n += vmap_holes[i].n;
+                        vmap_holes[i].n = 0;
+                } else if (vmap_holes[i].addr == end) {
+                        n += vmap_holes[i].n;
+                        end += vmap_holes[i].n * MM_PF_SIZE;
+                        vmap_holes[i].n = 0;
+                }
+        }
+
+        /* Ranges at the top just move the break back down */
+        if (end == vmap_break) {
+                vmap_break = addr;
+                return;
+        }
+
+        for (int i = 0; i < MM_VMAP_HOLES; i++) {
+                if (!vmap_holes[i].n) {
+                        vmap_holes[i].addr = addr;
+                        vmap_holes[i].n = n;
+                        return;
+                }
+        }
+
+        /* Out of slots; the addresses are lost but nothing is mapped there */
+        pr_warn("vmap_release(): dropping %d pages at %p\n", n, addr);
+
         return;
 }
 
@@ -488,12 +733,7 @@ void * MMU_alloc_page()
                 return ret;
         }
 
-        pt->address = 0;
-        /* Don't actually map page until something writes to it */
-        pt->present = 0;
-        pt->rw = 1;
-        pt->pcd = 1;
-        pt->available = PT_TO_ALLOC;
+        set_demand_page(pt);
 
         heap_break += MM_PF_SIZE;
 
@@ -527,17 +767,18 @@ void MMU_free_page(void * page)
         page = (void *)((uint64_t)page & ~(MM_PF_SIZE - 1));
 
         if (page > heap_break) {
-                printk("MMU_free_page():cannot free unallocated heap space!\n");
+                pr_warn_ratelimited("MMU_free_page():cannot free "
+                        "unallocated heap space!\n");
                 return;
         }
 
-        printk("trying to free %ld pages from heap\n",
+        pr_debug("trying to free %ld pages from heap\n",
                 (heap_break - page) / MM_PF_SIZE);
 
         for (int i = 0; i < (heap_break - page) / MM_PF_SIZE; i++) {
                 void * current = heap_break - MM_PF_SIZE * (i + 1);
                 struct pt * pt;
-                printk("freeing page %p\n", current);
+                pr_debug("freeing page %p\n", current);
 
                 /* Find the entry */
                 pt = resolve_virt_addr(p4_table, current);
@@ -549,7 +790,7 @@ void MMU_free_page(void * page)
                         /* Set up entry to be re-demand paged */
                         pt->address = 0;
                 } else {
-                        printk("page was never paged\n");
+                        pr_debug("page was never paged\n");
                 }
         }
 
@@ -561,3 +802,278 @@ void MMU_free_page(void * page)
 
         return;
 }
+
+/**
+ * MMU_map_region() - Reserve n demand paged pages outside the kernel heap 
+ * @n number of pages to map
+ * 
+ * Pages come from their own page aligned virtual range and get a physical
+ * frame on first touch, same as heap pages.
+ * 
+ * @return void * base address of region, MM_FRAME_EMPTY on failure
+ */
+void * MMU_map_region(int n)
+{
+        void * ret;
+
+        if (n <= 0)
+                return MM_FRAME_EMPTY;
+
+        ret = vmap_reserve(n);
+
+        if (ret == MM_FRAME_EMPTY)
+                return MM_FRAME_EMPTY;
+
+        for (int i = 0; i < n; i++) {
+                struct pt * pt = resolve_virt_addr(p4_table,
+                        ret + i * MM_PF_SIZE);
+
+                if (pt == MM_FRAME_EMPTY) {
+                        /* Undo what we've marked so far */
+                        MMU_unmap_region(ret, i);
+                        vmap_release(ret + i * MM_PF_SIZE, n - i);
+                        return MM_FRAME_EMPTY;
+                }
+
+                set_demand_page(pt);
+        }
+
+        return ret;
+}
+
+/**
+ * MMU_unmap_region() - Unmap a region from MMU_map_region() 
+ * @addr base address of region
+ * @n number of pages to unmap
+ * 
+ * Frees any frames that got faulted in and releases the virtual range.  Also
+ * works on the tail end of a region to shrink it.
+ * 
+ */
+void MMU_unmap_region(void * addr, int n)
+{
+        struct cr3 cr3;
+
+        if (n <= 0)
+                return;
+
+        addr = (void *)((uint64_t)addr & ~(MM_PF_SIZE - 1));
+
+        for (int i = 0; i < n; i++) {
+                struct pt * pt = resolve_virt_addr(p4_table,
+                        addr + i * MM_PF_SIZE);
+
+                if (pt == MM_FRAME_EMPTY)
+                        continue;
+
+                if (pt->present && pt->available == 0)
+                        MM_pf_free((void *)(pt->address & MM_ADDR_MASK));
+
+                pt->address = 0;
+        }
+
+        /* Read in the cr3 reg and write it back out to invalidate TLB */
+        asm("movq %%cr3, %0" : "=r"(cr3));
+        asm("movq %0, %%cr3" :: "r"(cr3));
+
+        vmap_release(addr, n);
+
+        return;
+}
+
+/**
+ * MMU_extend_region() - Grow a mapped region in place 
+ * @addr base address of region
+ * @n current number of pages in region
+ * @new_n number of pages wanted
+ * 
+ * Only works when the virtual pages right after the region are free, either
+ * at the mapped region break or at the start of a released range.
+ * 
+ * @return zero on success, nonzero if the following pages are taken
+ */
+int MMU_extend_region(void * addr, int n, int new_n)
+{
+        void * end = addr + n * MM_PF_SIZE;
+        int grow = new_n - n;
+        int i;
+
+        if (grow <= 0)
+                return 0;
+
+        /* Claim the addresses first */
+        if (end == vmap_break) {
+                if (vmap_break + grow * MM_PF_SIZE > (void *)MM_VMAP_END)
+                        return -1;
+
+                vmap_break += grow * MM_PF_SIZE;
+        } else {
+                for (i = 0; i < MM_VMAP_HOLES; i++) {
+                        if (vmap_holes[i].n >= grow
+                                        && vmap_holes[i].addr == end)
+                                break;
+                }
+
+                if (i == MM_VMAP_HOLES)
+                        return -1;
+
+                vmap_holes[i].addr += grow * MM_PF_SIZE;
+                vmap_holes[i].n -= grow;
+        }
+
+        for (i = 0; i < grow; i++) {
+                struct pt * pt = resolve_virt_addr(p4_table,
+                        end + i * MM_PF_SIZE);
+
+                if (pt == MM_FRAME_EMPTY) {
+                        MMU_unmap_region(end, i);
+                        vmap_release(end + i * MM_PF_SIZE, grow - i);
+                        return -1;
+                }
+
+                set_demand_page(pt);
+        }
+
+        return 0;
+}
+
+/**
+ * MMU_remap_region() - Move a mapped region to a bigger virtual range 
+ * @addr base address of region
+ * @n current number of pages in region
+ * @new_n number of pages wanted
+ * 
+ * Physical frames (and pages still waiting to be demand paged) are moved over
+ * by copying page table entries; the data itself is never copied.
+ * 
+ * @return void * new base address, MM_FRAME_EMPTY on failure
+ */
+void * MMU_remap_region(void * addr, int n, int new_n)
+{
+        struct cr3 cr3;
+        void * ret;
+
+        if (new_n < n)
+                return MM_FRAME_EMPTY;
+
+        ret = vmap_reserve(new_n);
+
+        if (ret == MM_FRAME_EMPTY)
+                return MM_FRAME_EMPTY;
+
+        /* Build any missing page tables before touching the old mapping so a
+         * failure leaves the region as it was */
+        for (int i = 0; i < new_n; i++) {
+                if (resolve_virt_addr(p4_table, ret + i * MM_PF_SIZE)
+                                == MM_FRAME_EMPTY) {
+                        vmap_release(ret, new_n);
+                        return MM_FRAME_EMPTY;
+                }
+        }
+
+        for (int i = 0; i < new_n; i++) {
+                struct pt * new_pt = resolve_virt_addr(p4_table,
+                        ret + i * MM_PF_SIZE);
+
+                if (i < n) {
+                        struct pt * old_pt = resolve_virt_addr(p4_table,
+                                addr + i * MM_PF_SIZE);
+
+                        new_pt->address = old_pt->address;
+                        old_pt->address = 0;
+                } else {
+                        set_demand_page(new_pt);
+                }
+        }
+
+        /* Read in the cr3 reg and write it back out to invalidate TLB */
+        asm("movq %%cr3, %0" : "=r"(cr3));
+        asm("movq %0, %%cr3" :: "r"(cr3));
+
+        vmap_release(addr, n);
+
+        return ret;
+}
+
+/**
+ * map_frames() - Map existing physical frames into the mapped region
+ * @phys physical address of the first frame
+ * @n number of contiguous frames to map
+ * @wc nonzero for write combining instead of uncached
+ *
+ * @return void * virtual address of the first frame, MM_FRAME_EMPTY on failure
+ */
+static void * map_frames(void * phys, int n, int wc)
+{
+        void * ret;
+
+        if (n <= 0)
+                return MM_FRAME_EMPTY;
+
+        ret = vmap_reserve(n);
+
+        if (ret == MM_FRAME_EMPTY)
+                return MM_FRAME_EMPTY;
+
+        for (int i = 0; i < n; i++) {
+                struct pt * pt = resolve_virt_addr(p4_table,
+                        ret + i * MM_PF_SIZE);
+
+                if (pt == MM_FRAME_EMPTY) {
+                        /* Clear what we set up but leave the frames alone */
+                        for (int j = 0; j < i; j++) {
+                                resolve_virt_addr(p4_table,
+                                        ret + j * MM_PF_SIZE)->address = 0;
+                        }
+
+                        vmap_release(ret, n);
+                        return MM_FRAME_EMPTY;
+                }
+
+                pt->address = (uint64_t)(phys + i * MM_PF_SIZE)
+                        & MM_ADDR_MASK;
+                pt->present = 1;
+                pt->rw = 1;
+
+                if (wc && pat_wc)
+                        pt->pat = 1;
+                else
+                        pt->pcd = 1;
+        }
+
+        return ret;
+}
+
+/**
+ * MMU_map_frames() - Map existing physical frames into the mapped region 
+ * @phys physical address of the first frame
+ * @n number of contiguous frames to map
+ * 
+ * Pages are present straight away (no demand paging) and uncached.  Unmap
+ * with MMU_unmap_region(), which also gives the frames back.
+ * 
+ * @return void * virtual address of the first frame, MM_FRAME_EMPTY on failure
+ */
+void * MMU_map_frames(void * phys, int n)
+{
+        return map_frames(phys, n, 0);
+}
+
+/**
+ * MMU_map_frames_wc() - Map device memory write combining
+ * @phys physical address of the first frame
+ * @n number of contiguous frames to map
+ *
+ * For framebuffers: writes get merged into bursts instead of going out one
+ * at a time, reads are still uncached and slow.  Falls back to uncached
+ * without PAT.  Never unmap it with MMU_unmap_region(), the frames aren't
+ * RAM.
+ *
+ * @return void * virtual address of the first frame, MM_FRAME_EMPTY on failure
+ */
+void * MMU_map_frames_wc(void * phys, int n)
+{
+        return map_frames(phys, n, 1);
+}
+
+#endif /* #ifndef FRAGARIA_HOSTED */
@@ -22,11 +22,21 @@
  * Base address   Use
  * 0x000000000000 Physical Page Frame Map (limits us to 512 GB physical RAM)
  * 0x008000000000 Kernel heap base - PML4E slot 1
- * Heap and stack growth - PML4E slots 3-31
+ * Heap growth - PML4E slots 2-15
+ * 0x080000000000 Mapped regions for large allocations - PML4E slots 16-29
  * 0x0F0000000000 Base of kernel stack space (bottom of first 512 GB of stacks)
  * 0x100000000000 Base of user space - not used yet - PML4E slot 32
  */
 
+#define MM_VMAP_BASE                            (0x080000000000)
+#define MM_VMAP_END                             (0x0F0000000000)
+#define MM_VMAP_HOLES                           32
+
+/* MM_init() makes PAT entry 4 (PAT bit set, PCD and PWT clear) write
+ * combining for MMU_map_frames_wc(); entries 0-3 keep their reset values */
+#define MM_PAT_WC_ENTRY                         4
+#define MM_PAT_WC                               0x01
+
 /**
  * struct MM_unused
  * Store RAM regions returned by multiboot2, ready to be allocated
@@ -42,11 +52,29 @@ struct MM_unused {
         void * current;
 };
 
+/**
+ * struct MM_vmap_hole
+ * Range of released virtual pages below the mapped region break, ready to be
+ * handed out again by MMU_map_region()
+ *
+ * @addr base address of the range
+ * @n number of pages in the range; zero marks an unused slot
+ *
+ */
+struct MM_vmap_hole {
+        void * addr;
+        uint64_t n;
+};
+
 /* This is an invalid 64-bit address(not 48-bit sign extended), so use to mark
  * entries in the allocated and free lists that got removed */
 #define MM_FRAME_EMPTY                          (void *)(0xFF00000000000000)
 #define MM_FRAME_LIST_CAPACITY                  510
 
+/* Frames MM_pf_alloc_contig() checks per pass over the used list; its bitmap
+ * of them lives on the stack */
+#define MM_CONTIG_WINDOW                        4096
+
 /**
  * struct MM_frame_list
  * Store a number page frame addresses in one struct; should cleanly fill a page
@@ -152,6 +180,7 @@ struct pt {
 void MM_init(struct multiboot_table_header *);
 void * MM_pf_alloc(void);
 void MM_pf_free(void *);
+void * MM_pf_alloc_contig(int);
 
 /* 
  * Virtual page allocator functions
@@ -163,5 +192,11 @@ extern struct pml4 p4_table[512];
 void * MMU_alloc_page(void);
 void * MMU_alloc_pages(int);
 void MMU_free_page(void *);
+void * MMU_map_region(int);
+void MMU_unmap_region(void *, int);
+int MMU_extend_region(void *, int, int);
+void * MMU_remap_region(void *, int, int);
+void * MMU_map_frames(void *, int);
+void * MMU_map_frames_wc(void *, int);
 
 #endif /* #ifndef MM_H */
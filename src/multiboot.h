@@ -162,7 +162,7 @@ struct multiboot_vbe_info {
 
 #define MULTIBOOT_FRAMEBUFF_INFO                8
 #define MULTIBOOT_FRAMEBUFF_TYPE_INDEXED        0
-#define MULITBOOT_FRAMEBUFF_TYPE_RGB            1
+#define MULTIBOOT_FRAMEBUFF_TYPE_RGB            1
 #define MULTIBOOT_FRAMEBUFF_TYPE_EGA            2
 struct multiboot_color_descriptor {
         uint8_t red;
@@ -192,12 +192,11 @@ struct multiboot_framebuff_info {
         uint32_t framebuffer_height;
         uint8_t framebuffer_bpp;
         uint8_t framebuffer_type;
-        uint8_t reserved;
+        uint16_t reserved;                      /* GRUB's layout, not 8 bits */
         union {
                 struct multiboot_framebuff_palette palette;
                 struct multiboot_framebuff_rgb rgb;
         } color_info;
-        
 } __attribute__((packed));
 
 #endif /* #ifndef MULTIBOOT_H */
@@ -15,6 +15,20 @@ header_start:
 
         ; optional multiboot tags
 
+%ifdef FRAMEBUFFER
+        ; framebuffer, any size at 32 bpp; fbcon.c draws on it.  Only asked
+        ; for when built with it, since once the loader leaves text mode
+        ; the VGA console can't be seen even if fbcon.c fails to start
+        align 8, db 0
+        dw 5                            ; type
+        dw 1                            ; optional
+        dd 20                           ; size
+        dd 0                            ; width, no preference
+        dd 0                            ; height, no preference
+        dd 32                           ; depth
+%endif
+
+        align 8, db 0
         ; end tag
         dw 0
         dw 0
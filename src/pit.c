@@ -0,0 +1,53 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/pit.c
+ *
+ * Programmable interval timer, used as the periodic kernel tick
+ *
+ */
+
+#include <stdint.h>
+
+#include "irq.h"
+#include "pit.h"
+#include "port_io.h"
+#include "printk.h"
+#include "trace.h"
+
+volatile uint64_t PIT_ticks = 0;
+
+/**
+ * pit_pic_handle() - Timer tick
+ *
+ * Context: ISR
+ *
+ * Drains whatever printk() has queued since the last tick.
+ */
+void pit_pic_handle()
+{
+        PIT_ticks++;
+        trace(TIMER_TICK, PIT_ticks);
+
+        printk_drain();
+
+        return;
+}
+
+/**
+ * PIT_init() - Start channel 0 ticking at PIT_HZ
+ *
+ * Context: not ISR; must be called after IRQ/PIC setup
+ *
+ */
+void PIT_init()
+{
+        uint16_t divisor = PIT_BASE_FREQ / PIT_HZ;
+
+        outb(PIT_IO_COMMAND, PIT_CHANNEL0 | PIT_ACCESS_LOHI | PIT_MODE_RATE);
+        outb(PIT_IO_CHANNEL0, divisor & 0xFF);
+        outb(PIT_IO_CHANNEL0, divisor >> 8);
+
+        IRQ_clear_mask(PIC_PROG_TIMER);
+
+        return;
+}
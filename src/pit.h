@@ -0,0 +1,30 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/pit.h
+ *
+ * Header for the programmable interval timer
+ *
+ */
+
+#ifndef PIT_H
+#define PIT_H                                   1
+
+#include <stdint.h>
+
+#define PIT_IO_CHANNEL0                         0x40
+#define PIT_IO_COMMAND                          0x43
+
+#define PIT_BASE_FREQ                           1193182 /* Hz */
+#define PIT_HZ                                  100
+
+/* Command register bitmasks */
+#define PIT_CHANNEL0                            (0b00<<6)
+#define PIT_ACCESS_LOHI                         (0b11<<4)
+#define PIT_MODE_RATE                           (0b010<<1)
+
+extern volatile uint64_t PIT_ticks;
+
+void pit_pic_handle(void);
+void PIT_init(void);
+
+#endif /* #ifndef PIT_H */
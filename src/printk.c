@@ -9,224 +9,845 @@
 #include <stdarg.h>
 #include <stdint.h>
 
+#include "irq.h"
+#include "pit.h"
 #include "printk.h"
 #include "serial.h"
 #include "string.h"
-#include "vga.h"
+#include "vt.h"
 
-static void output(char c)
+/*
+ * printk() formats each message on the stack, then copies it into log_buf as
+ * one record and returns; consoles are written later, in bulk, by
+ * printk_drain() from the timer tick.
+ *
+ * Producers reserve space by moving log_head with a compare and swap, so any
+ * number of them (including interrupt handlers that cut into another
+ * printk) can fill records at once.  A record only becomes visible to the
+ * drain when its committed flag is set.  The drain is the only consumer: it
+ * prints committed records in order, zeroes them so the space reads as
+ * uncommitted when reused, and moves log_tail along.  A record that doesn't
+ * fit before the end of the buffer leaves a padding record there and starts
+ * over at the front.  When the buffer is full new messages are dropped and
+ * counted.
+ */
+
+/**
+ * struct log_record - header of one message in log_buf
+ * @committed: Set once the text is in place
+ * @size: Bytes to the next record, header included; a multiple of 8
+ * @len: Bytes of text after the header, 0 for padding
+ */
+struct log_record {
+        uint32_t committed;
+        uint16_t size;
+        uint16_t len;
+};
+
+static char log_buf[LOG_BUF_LEN] __attribute__((aligned(8)));
+static uint64_t log_head = 0, log_tail = 0;
+static uint32_t log_dropped = 0;
+static uint8_t log_draining = 0, log_async = 0;
+
+/* Set while something else owns serial, see printk_serial_hold() */
+static uint8_t log_serial_hold = 0;
+
+/* Progress through the record at log_tail when serial ran out of room: it's
+ * on screen once log_shown is set, and log_sent bytes of it went to serial */
+static uint8_t log_shown = 0;
+static int log_sent = 0;
+
+/* "messages dropped" note, kept until serial has taken all of it */
+static char log_note[40];
+static int log_note_len = 0, log_note_sent = 0;
+static int console_level = PRINTK_CONSOLE_LEVEL;
+
+/* On while console_level includes debug messages, set by printk_cmdline() */
+struct static_key printk_debug_key = STATIC_KEY_INIT_FALSE;
+
+/**
+ * log_store() - copy one message into log_buf
+ * @text: Message
+ * @len: Length in bytes, at most LOG_LINE_MAX
+ *
+ * Context: ISR safe; never waits
+ *
+ * Return: void
+ */
+static void log_store(const char * text, int len)
 {
-        VGA_display_char(c);
-        SER_write(&c, 1);
+        uint64_t head, pad, size;
+        struct log_record * rec;
+
+        size = sizeof(struct log_record) + ((len + 7) & ~7);
+
+        do {
+                head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+
+                pad = LOG_BUF_LEN - head % LOG_BUF_LEN;
+                if (pad >= size)
+                        pad = 0;
+
+                if (head + pad + size - __atomic_load_n(&log_tail,
+                                __ATOMIC_ACQUIRE) > LOG_BUF_LEN) {
+                        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+                        return;
+                }
+        } while (!__atomic_compare_exchange_n(&log_head, &head,
+                        head + pad + size, 0, __ATOMIC_ACQ_REL,
+                        __ATOMIC_RELAXED));
+
+        if (pad) {
+                rec = (struct log_record *)(log_buf + head % LOG_BUF_LEN);
+                rec->size = pad;
+                rec->len = 0;
+                __atomic_store_n(&rec->committed, 1, __ATOMIC_RELEASE);
+
+                head += pad;
+        }
+
+        rec = (struct log_record *)(log_buf + head % LOG_BUF_LEN);
+        rec->size = size;
+        rec->len = len;
+        memcpy(rec + 1, text, len);
+        __atomic_store_n(&rec->committed, 1, __ATOMIC_RELEASE);
+
         return;
 }
 
-static int print_hex(unsigned long int x)
-{
-        long int i = 1;
-        int ret = 0;
+/* Conversion flags */
+#define FMT_LEFT                                (1 << 0)        /* - */
+#define FMT_ZERO                                (1 << 1)        /* 0 */
+#define FMT_PLUS                                (1 << 2)        /* + */
+#define FMT_SPACE                               (1 << 3)        /* ' ' */
+#define FMT_ALT                                 (1 << 4)        /* # */
+
+/**
+ * struct fmt_out - where vsnprintk() is writing
+ * @buf: Caller's buffer
+ * @size: Size of buf
+ * @len: Characters produced so far, including any that didn't fit
+ */
+struct fmt_out {
+        char * buf;
+        size_t size;
+        size_t len;
+};
 
-        /* Calculate how many digits we're printing (log_16(x)) */
-        for (long int j = x / 16; j > 0; j = j / 16)
-                i = i * 16;
+/**
+ * struct fmt_spec - one parsed conversion
+ * @flags: FMT_* flags
+ * @width: Minimum field width
+ * @precision: Minimum digits, or maximum string length; -1 if not given
+ */
+struct fmt_spec {
+        int flags;
+        int width;
+        int precision;
+};
+
+/* "00" to "99", so decimal conversion does one division per two digits */
+static const char digit_pairs[201] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
 
-        /* Print them in reverse order */
-        for (; i > 0; i = i / 16) {
-                if((x / i) % 16 < 10)
-                        output('0' + ((x / i) % 16));
-                else
-                        output('a' - 10 + ((x / i) % 16));
-                ret++;
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+static void put_str(struct fmt_out * out, const char * s, size_t n)
+{
+        if (out->len < out->size) {
+                size_t room = out->size - out->len;
+
+                memcpy(out->buf + out->len, s, n < room ? n : room);
         }
 
-        return ret;
+        out->len += n;
+
+        return;
 }
 
-static int print_unsigned(unsigned long int u)
+static void put_pad(struct fmt_out * out, char c, int n)
 {
-        long int i = 1;
-        int ret = 0;
+        for (; n > 0; n--) {
+                if (out->len < out->size)
+                        out->buf[out->len] = c;
 
-        /* Calculate how many digits we're printing (log_10(u)) */
-        for (long int j = u / 10; j > 0; j = j / 10)
-                i = i * 10;
-        
-        /* Print them in reverse order */
-        for (; i > 0; i = i / 10) {
-                output('0' + ((u / i) % 10));
-                ret++;
+                out->len++;
         }
 
-        return ret;
+        return;
 }
 
-static int print_decimal(long int d)
+/**
+ * format_decimal() - write v in decimal, ending just before end
+ * @end: One past where the last digit goes
+ * @v: Value
+ *
+ * Return: number of digits
+ */
+static int format_decimal(char * end, uint64_t v)
 {
-        int ret = 0;
+        char * p = end;
+
+        while (v >= 100) {
+                unsigned int r = v % 100;
+
+                v /= 100;
+                p -= 2;
+                memcpy(p, digit_pairs + 2 * r, 2);
+        }
 
-        /* If we have a negative number, print negative and treat invert */
-        if (d < 0) {
-                d = d * -1;
-                output('-');
-                ret++;
+        if (v >= 10) {
+                p -= 2;
+                memcpy(p, digit_pairs + 2 * v, 2);
+        } else {
+                *--p = '0' + v;
         }
 
-        /* Let unsigned int printer handle the now positive number */
-        return ret + print_unsigned((unsigned int)d);
+        return end - p;
 }
 
-__attribute__((format (printf, 1, 2)))
-int printk(const char * fmt, ...)
+/**
+ * format_power2() - write v in base 8 or 16, ending just before end
+ * @end: One past where the last digit goes
+ * @v: Value
+ * @shift: 3 for octal, 4 for hex
+ * @digits: Digit characters
+ *
+ * Return: number of digits
+ */
+static int format_power2(char * end, uint64_t v, int shift,
+        const char * digits)
 {
-        int ret = 0;
+        char * p = end;
+
+        do {
+                *--p = digits[v & ((1 << shift) - 1)];
+                v >>= shift;
+        } while (v);
+
+        return end - p;
+}
+
+/**
+ * put_number() - write a converted integer with sign, prefix and padding
+ * @out: Output
+ * @spec: Flags, width and precision
+ * @v: Magnitude
+ * @sign: '-', '+', ' ' or 0
+ * @prefix: "0x" and the like, or ""
+ * @conv: Conversion character, picks the base
+ *
+ * Return: void
+ */
+static void put_number(struct fmt_out * out, struct fmt_spec * spec,
+        uint64_t v, char sign, const char * prefix, char conv)
+{
+        char digits[24];
+        char * end = digits + sizeof(digits);
+        int n, zeros, pad, prefix_len = strlen(prefix);
+
+        if (conv == 'x' || conv == 'p')
+                n = format_power2(end, v, 4, hex_lower);
+        else if (conv == 'X')
+                n = format_power2(end, v, 4, hex_upper);
+        else if (conv == 'o')
+                n = format_power2(end, v, 3, hex_lower);
+        else
+                n = format_decimal(end, v);
+
+        /* An explicit zero precision prints nothing for zero */
+        if (spec->precision == 0 && v == 0)
+                n = 0;
+
+        zeros = spec->precision > n ? spec->precision - n : 0;
+        pad = spec->width - n - zeros - prefix_len - (sign != 0);
+
+        if ((spec->flags & FMT_ZERO) && !(spec->flags & FMT_LEFT)
+                        && spec->precision < 0 && pad > 0) {
+                zeros += pad;
+                pad = 0;
+        }
+
+        if (!(spec->flags & FMT_LEFT))
+                put_pad(out, ' ', pad);
 
-        /* Set up va_list */
-        va_list current;
-        va_start(current, fmt);
+        if (sign)
+                put_pad(out, sign, 1);
+
+        put_str(out, prefix, prefix_len);
+        put_pad(out, '0', zeros);
+        put_str(out, end - n, n);
+
+        if (spec->flags & FMT_LEFT)
+                put_pad(out, ' ', pad);
+
+        return;
+}
+
+/**
+ * vsnprintk() - format into a buffer
+ * @buf: Buffer
+ * @size: Size of buf; the result is cut to fit and always terminated
+ * @fmt: printf style format
+ * @args: Arguments
+ *
+ * Supports the flags "-0+ #", widths and precisions (also as "*"), the
+ * lengths hh, h, l, ll, q and z, and the conversions d i u o x X p c s %.
+ *
+ * Return: length of the whole formatted string, even if it didn't all fit
+ */
+int vsnprintk(char * buf, size_t size, const char * fmt, va_list args)
+{
+        struct fmt_out out = {buf, size, 0};
 
-        /* Parse the format string */
         while (*fmt) {
-                if (*fmt == '%') {
-                        if (!(*fmt++)) 
+                struct fmt_spec spec = {0, 0, -1};
+                const char * run = fmt;
+                int length = 0;
+                uint64_t v;
+                char sign = 0;
+
+                /* Copy plain text up to the next conversion in one go */
+                while (*fmt && *fmt != '%')
+                        fmt++;
+                put_str(&out, run, fmt - run);
+
+                if (!*fmt++)
+                        break;
+
+                for (;; fmt++) {
+                        if (*fmt == '-')
+                                spec.flags |= FMT_LEFT;
+                        else if (*fmt == '0')
+                                spec.flags |= FMT_ZERO;
+                        else if (*fmt == '+')
+                                spec.flags |= FMT_PLUS;
+                        else if (*fmt == ' ')
+                                spec.flags |= FMT_SPACE;
+                        else if (*fmt == '#')
+                                spec.flags |= FMT_ALT;
+                        else
                                 break;
+                }
 
-                        switch (*fmt) {
-                        case '%':
-                                        output('%');
-                                        ret++;
-                                        fmt++;
-                                        break;
-                        case 'd':
-                        case 'i':
-                                        ret += print_decimal(va_arg(current,
-                                                        int));
-                                        fmt++;
-                                        break;
-                        case 'u':
-                                        ret += print_unsigned(va_arg(current,
-                                                        unsigned int));
-                                        fmt++;
-                                        break;
-                        case 'x':
-                        case 'X':       /* Handle X the same as x */
-                                        ret += print_hex(va_arg(current,
-                                                        unsigned int));
-                                        fmt++;
-                                        break;
-                        case 'c':
-                                        output(0xFF & va_arg(current,
-                                                        unsigned int));
-                                        ret++;
-                                        fmt++;
-                                        break;
-                        case 'p':
-                                        /* Print 0x */
-                                        output('0');
-                                        output('x');
-                                        /* Then do the same as lx */
-                                        ret += 2 + print_hex(va_arg(current,
-                                                        unsigned long));
-                                        fmt++;
-                                        break;
-                        case 'h':
-                                        /* half/short length modier %h[dux] */
-                                        /* if %h at end of string, this should
-                                         * cleanly exit printk */ 
-                                        if (!(*fmt++))
-                                                continue;
-
-                                        switch (*fmt) {
-                                case 'd':
-                                case 'i':
-                                        ret += print_decimal(va_arg(current,
-                                                        int));
-                                        fmt++;
-                                        break;
-                                case 'u':
-                                        ret += print_unsigned(va_arg(current,
-                                                        unsigned int));
-                                        fmt++;
-                                        break;
-                                case 'x':
-                                case 'X':
-                                        ret += print_hex(va_arg(current,
-                                                        unsigned int));
-                                        fmt++;
-                                        break;
-                                default:
-                                        }
-                                        break;
-                        case 'l':
-                                        /* long length modifier %l[dux] */
-                                        if (!(*fmt++))
-                                                continue;
-
-                                        switch (*fmt) {
-                                case 'd':
-                                case 'i':
-                                        ret += print_decimal(va_arg(current,
-                                                        long));
-                                        fmt++;
-                                        break;
-                                case 'u':
-                                        ret += print_unsigned(va_arg(current,
-                                                        unsigned long));
-                                        fmt++;
-                                        break;
-                                case 'x':
-                                case 'X':
-                                        ret += print_hex(va_arg(current,
-                                                        unsigned long));
-                                        fmt++;
-                                        break;
-                                default:
-                                        }
-
-                                        break;
-                        case 'q':
-                                        /* quad/long long modifier %q[dux] */
-                                        if (!(*fmt++))
-                                                continue;
-
-                                        switch (*fmt) {
-                                case 'd':
-                                case 'i':
-                                        ret += print_decimal(va_arg(current,
-                                                        long long));
-                                        fmt++;
-                                        break;
-                                case 'u':
-                                        ret += print_unsigned(va_arg(current,
-                                                        unsigned long long));
-                                        fmt++;
-                                        break;
-                                case 'x':
-                                case 'X':
-                                        ret += print_hex(va_arg(current,
-                                                        unsigned long long));
-                                        fmt++;
-                                        break;
-                                default:
-                                        }
-
-                                        break;
-                        case 's':
-                                        char * cs = va_arg(current, char *);
-                                        ret += VGA_display_str(cs);
-                                        SER_write(cs, strlen(cs));
-                                        fmt++;
-                                        break;
-                        default:
+                if (*fmt == '*') {
+                        spec.width = va_arg(args, int);
+                        fmt++;
+
+                        if (spec.width < 0) {
+                                spec.flags |= FMT_LEFT;
+                                spec.width = -spec.width;
                         }
                 } else {
-                        output(*fmt);
-                        ret++;
+                        for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                                spec.width = spec.width * 10 + *fmt - '0';
+                }
+
+                if (*fmt == '.') {
                         fmt++;
+                        spec.precision = 0;
+
+                        if (*fmt == '*') {
+                                spec.precision = va_arg(args, int);
+                                fmt++;
+                        } else {
+                                for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+                                        spec.precision = spec.precision * 10
+                                                + *fmt - '0';
+                        }
+                }
+
+                /* Count h's as negative and l's as positive */
+                for (;; fmt++) {
+                        if (*fmt == 'h')
+                                length--;
+                        else if (*fmt == 'l')
+                                length++;
+                        else if (*fmt == 'q')
+                                length = 2;
+                        else if (*fmt == 'z')
+                                length = 1;
+                        else
+                                break;
+                }
+
+                switch (*fmt) {
+                case 'd':
+                case 'i':
+                        {
+                                int64_t d;
+
+                                if (length >= 2)
+                                        d = va_arg(args, long long);
+                                else if (length == 1)
+                                        d = va_arg(args, long);
+                                else if (length == -1)
+                                        d = (short)va_arg(args, int);
+                                else if (length <= -2)
+                                        d = (signed char)va_arg(args, int);
+                                else
+                                        d = va_arg(args, int);
+
+                                if (d < 0)
+                                        sign = '-';
+                                else if (spec.flags & FMT_PLUS)
+                                        sign = '+';
+                                else if (spec.flags & FMT_SPACE)
+                                        sign = ' ';
+
+                                v = d < 0 ? -(uint64_t)d : (uint64_t)d;
+                                put_number(&out, &spec, v, sign, "", 'd');
+                        }
+                        break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                        if (length >= 2)
+                                v = va_arg(args, unsigned long long);
+                        else if (length == 1)
+                                v = va_arg(args, unsigned long);
+                        else if (length == -1)
+                                v = (unsigned short)va_arg(args, unsigned int);
+                        else if (length <= -2)
+                                v = (unsigned char)va_arg(args, unsigned int);
+                        else
+                                v = va_arg(args, unsigned int);
+
+                        put_number(&out, &spec, v, 0,
+                                !(spec.flags & FMT_ALT) || !v ? ""
+                                : *fmt == 'o' ? "0"
+                                : *fmt == 'x' ? "0x" : *fmt == 'X' ? "0X" : "",
+                                *fmt);
+                        break;
+                case 'p':
+                        v = (uintptr_t)va_arg(args, void *);
+                        put_number(&out, &spec, v, 0, "0x", 'p');
+                        break;
+                case 'c':
+                        {
+                                char c = va_arg(args, int);
+
+                                if (!(spec.flags & FMT_LEFT))
+                                        put_pad(&out, ' ', spec.width - 1);
+                                put_str(&out, &c, 1);
+                                if (spec.flags & FMT_LEFT)
+                                        put_pad(&out, ' ', spec.width - 1);
+                        }
+                        break;
+                case 's':
+                        {
+                                const char * str = va_arg(args, char *);
+                                int n = 0;
+
+                                if (!str)
+                                        str = "(null)";
+
+                                while (str[n] && (spec.precision < 0
+                                                || n < spec.precision))
+                                        n++;
+
+                                if (!(spec.flags & FMT_LEFT))
+                                        put_pad(&out, ' ', spec.width - n);
+                                put_str(&out, str, n);
+                                if (spec.flags & FMT_LEFT)
+                                        put_pad(&out, ' ', spec.width - n);
+                        }
+                        break;
+                case '%':
+                        put_str(&out, "%", 1);
+                        break;
+                case '\0':
+                        /* Format ended mid-conversion */
+                        fmt--;
+                        break;
+                default:
+                        /* Unknown conversion, print it as is */
+                        put_str(&out, fmt, 1);
                 }
+
+                fmt++;
         }
 
-        /* Clean up va_list */
-        va_end(current);
+        if (size)
+                buf[out.len < size ? out.len : size - 1] = '\0';
+
+        return out.len;
+}
+
+/**
+ * snprintk() - format into a buffer
+ * @buf: Buffer
+ * @size: Size of buf; the result is cut to fit and always terminated
+ * @fmt: printf style format
+ *
+ * Return: length of the whole formatted string, even if it didn't all fit
+ */
+__attribute__((format (printf, 3, 4)))
+int snprintk(char * buf, size_t size, const char * fmt, ...)
+{
+        va_list args;
+        int ret;
+
+        va_start(args, fmt);
+        ret = vsnprintk(buf, size, fmt, args);
+        va_end(args);
 
         return ret;
 }
+
+/**
+ * printk() - format a message and queue it for the consoles
+ * @fmt: printf style format, see vsnprintk(); may start with a KERN_* level
+ *
+ * Messages less severe than the console level are dropped right away.
+ * Messages longer than LOG_LINE_MAX - 1 are cut.
+ *
+ * Return: number of characters in the whole message, 0 if filtered
+ */
+__attribute__((format (printf, 1, 2)))
+int printk(const char * fmt, ...)
+{
+        char line[LOG_LINE_MAX];
+        int level = LOGLEVEL_DEFAULT;
+        va_list args;
+        int ret;
+
+        if (fmt[0] == KERN_SOH[0] && fmt[1] >= '0' && fmt[1] <= '7') {
+                level = fmt[1] - '0';
+                fmt += 2;
+        }
+
+        /* Filtered out before any formatting happens */
+        if (level > console_level)
+                return 0;
+
+        va_start(args, fmt);
+        ret = vsnprintk(line, sizeof(line), fmt, args);
+        va_end(args);
+
+        log_store(line, ret < LOG_LINE_MAX ? ret : LOG_LINE_MAX - 1);
+
+        /* Until the timer runs, nothing else would print it */
+        if (!log_async)
+                printk_drain();
+
+        return ret;
+}
+
+/**
+ * printk_echo() - queue text typed at the console
+ * @text: Text
+ * @len: Length in bytes, cut to LOG_LINE_MAX - 1
+ *
+ * Goes through the log so it stays in order with messages, but isn't a
+ * message: it has no level and console_level never hides it.
+ *
+ * Context: ISR safe
+ *
+ * Return: void
+ */
+void printk_echo(const char * text, int len)
+{
+        log_store(text, len < LOG_LINE_MAX ? len : LOG_LINE_MAX - 1);
+
+        if (!log_async)
+                printk_drain();
+
+        return;
+}
+
+/**
+ * ser_send() - queue text for serial, picking up where the last try stopped
+ * @buff: Text
+ * @len: Length
+ * @sent: Bytes of it already queued; updated
+ * @force: Poll the transmitter until it all fits instead of giving up
+ *
+ * SER_write() only takes what fits in its ring.  Before SER_init() it takes
+ * nothing at all, and then the text only goes to the screen.  While serial
+ * is held nothing is sent, except when forced.
+ *
+ * Return: zero once all of it is queued, -1 if some is left for next time
+ */
+static int ser_send(const char * buff, int len, int * sent, int force)
+{
+        if (*sent < len && log_serial_hold && !force)
+                return -1;
+
+        while (*sent < len) {
+                int n = SER_write(buff + *sent, len - *sent);
+
+                if (n < 0) {
+                        *sent = len;
+                        break;
+                }
+
+                *sent += n;
+
+                if (*sent < len) {
+                        if (!force)
+                                return -1;
+
+                        SER_flush();
+                }
+        }
+
+        return 0;
+}
+
+/**
+ * drain_records() - write committed records to the consoles
+ * @force: Skip records still being written instead of stopping at them, and
+ *      wait for serial rather than leave anything for the next drain
+ *
+ * When the serial ring fills up the drain stops at that record and the next
+ * one carries on from the same byte, so nothing is lost at slow baud rates.
+ *
+ * Return: void
+ */
+static void drain_records(int force)
+{
+        uint64_t tail = log_tail;
+        uint32_t dropped;
+
+        /* A note that didn't fit last time goes before anything newer */
+        if (ser_send(log_note, log_note_len, &log_note_sent, force))
+                goto exit;
+
+        while (tail != __atomic_load_n(&log_head, __ATOMIC_ACQUIRE)) {
+                struct log_record * rec;
+
+                rec = (struct log_record *)(log_buf + tail % LOG_BUF_LEN);
+
+                /* A size of 0 means the writer hasn't even got that far */
+                if (!__atomic_load_n(&rec->committed, __ATOMIC_ACQUIRE)
+                                && (!force || !rec->size))
+                        break;
+
+                if (rec->committed && rec->len) {
+                        if (!log_shown) {
+                                VT_write(VT_LOG, (char *)(rec + 1), rec->len);
+                                log_shown = 1;
+                        }
+
+                        if (ser_send((char *)(rec + 1), rec->len, &log_sent,
+                                        force))
+                                goto exit;
+                }
+
+                log_shown = 0;
+                log_sent = 0;
+
+                tail += rec->size;
+                memset(rec, 0, rec->size);
+                __atomic_store_n(&log_tail, tail, __ATOMIC_RELEASE);
+        }
+
+        /* Straight to the consoles; the ring may well be full again */
+        dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+                log_note_len = snprintk(log_note, sizeof(log_note),
+                        "printk: %u messages dropped\n", dropped);
+                log_note_sent = 0;
+                VT_write(VT_LOG, log_note, log_note_len);
+                ser_send(log_note, log_note_len, &log_note_sent, force);
+        }
+
+exit:
+        if (force)
+                VT_sync();
+        else
+                VT_flush();
+
+        return;
+}
+
+/**
+ * printk_drain() - write out everything printk() has queued
+ *
+ * Context: ISR safe; returns right away if a drain is already running
+ *
+ */
+void printk_drain()
+{
+        if (__atomic_exchange_n(&log_draining, 1, __ATOMIC_ACQUIRE))
+                return;
+
+        drain_records(0);
+
+        __atomic_store_n(&log_draining, 0, __ATOMIC_RELEASE);
+
+        return;
+}
+
+/**
+ * printk_flush() - write out everything now, and wait for serial to send it
+ *
+ * Context: for panics, called right before stopping; ignores a drain that
+ *      might have been interrupted
+ *
+ */
+void printk_flush()
+{
+        /* Whatever was on screen, this needs to be seen */
+        VT_switch(VT_LOG);
+        drain_records(1);
+        SER_flush();
+
+        return;
+}
+
+/**
+ * printk_wait() - wait for the log to make room
+ * @len: Bytes of messages about to be printed, at most LOG_BUF_LEN / 2
+ *
+ * For code that prints more than the log holds, like trace_dump(); without
+ * this everything past the first LOG_BUF_LEN bytes would be dropped.  Lets
+ * the timer tick drain the log rather than pushing it out itself.
+ *
+ * Context: task context; returns right away with interrupts off, since
+ *      nothing could drain the log then
+ *
+ */
+void printk_wait(int len)
+{
+        printk_drain();
+
+        while (__atomic_load_n(&log_head, __ATOMIC_ACQUIRE)
+                        - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE)
+                        > LOG_BUF_LEN - 2 * len) {
+                if (!log_async || !interrupts_enabled())
+                        return;
+
+                asm("hlt");
+        }
+
+        return;
+}
+
+/**
+ * printk_serial_hold() - keep printk off serial for a while
+ * @hold: Nonzero to hold it off, zero to let it carry on
+ *
+ * For trace_export(), which needs serial to itself.  Messages wait in the
+ * log meanwhile, which drops them once it's full; printk_flush() sends them
+ * regardless.
+ *
+ */
+void printk_serial_hold(int hold)
+{
+        __atomic_store_n(&log_serial_hold, hold != 0, __ATOMIC_RELEASE);
+
+        return;
+}
+
+/**
+ * printk_async() - leave printing to printk_drain() from now on
+ *
+ * Context: call once the timer calls printk_drain()
+ *
+ */
+void printk_async()
+{
+        log_async = 1;
+
+        return;
+}
+
+/**
+ * printk_ratelimit() - take a token from a call site's bucket
+ * @rs: The call site's bucket
+ * @func: Function the call site is in, for the suppressed summary
+ *
+ * Refills a token every PRINTK_RATELIMIT_REFILL PIT ticks, up to
+ * PRINTK_RATELIMIT_BURST.  When a message gets through after some were
+ * dropped, says how many first.  Before PIT_init() time doesn't move, so a
+ * call site gets its first burst and nothing more.  Use printk_ratelimited()
+ * and friends rather than calling this.
+ *
+ * Context: ISR safe
+ *
+ * Return: nonzero if the message should print
+ */
+int printk_ratelimit(struct printk_ratelimit * rs, const char * func)
+{
+        uint8_t enable_ints = 0;
+        uint32_t suppressed = 0;
+        uint64_t refill;
+        int ret = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        refill = (PIT_ticks - rs->stamp) / PRINTK_RATELIMIT_REFILL;
+
+        if (refill) {
+                rs->stamp += refill * PRINTK_RATELIMIT_REFILL;
+                rs->tokens = refill >= PRINTK_RATELIMIT_BURST - rs->tokens
+                        ? PRINTK_RATELIMIT_BURST : rs->tokens + refill;
+        }
+
+        if (rs->tokens) {
+                rs->tokens--;
+                suppressed = rs->suppressed;
+                rs->suppressed = 0;
+                ret = 1;
+        } else {
+                rs->suppressed++;
+        }
+
+        if (enable_ints)
+                STI;
+
+        if (suppressed)
+                pr_warn("%s: %u messages suppressed\n", func, suppressed);
+
+        return ret;
+}
+
+/**
+ * printk_cmdline() - take the console level from the boot command line
+ * @cmdline: Command line, words separated by spaces
+ *
+ * Understands loglevel=N (print levels 0 to N), quiet (warnings and worse)
+ * and debug.  Levels compiled out with PRINTK_COMPILE_LEVEL stay out.
+ * pr_debug() sites get patched in or out to match.
+ *
+ */
+void printk_cmdline(const char * cmdline)
+{
+        while (*cmdline) {
+                const char * word = cmdline;
+                int len;
+
+                while (*cmdline && *cmdline != ' ')
+                        cmdline++;
+                len = cmdline - word;
+
+                if (len == 10 && !memcmp(word, "loglevel=", 9)
+                                && word[9] >= '0' && word[9] <= '7')
+                        console_level = word[9] - '0';
+                else if (len == 5 && !memcmp(word, "quiet", 5))
+                        console_level = LOGLEVEL_WARNING;
+                else if (len == 5 && !memcmp(word, "debug", 5))
+                        console_level = LOGLEVEL_DEBUG;
+
+                while (*cmdline == ' ')
+                        cmdline++;
+        }
+
+        if (console_level >= LOGLEVEL_DEBUG)
+                static_key_enable(&printk_debug_key);
+        else
+                static_key_disable(&printk_debug_key);
+
+        return;
+}
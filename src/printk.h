@@ -9,6 +9,127 @@
 #ifndef PRINTK_H
 #define PRINTK_H                                1
 
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jump_label.h"
+
+/* Message levels; a KERN_* prefix in the format string sets the level */
+#define LOGLEVEL_EMERG                          0       /* system is dead */
+#define LOGLEVEL_ALERT                          1
+#define LOGLEVEL_CRIT                           2
+#define LOGLEVEL_ERR                            3
+#define LOGLEVEL_WARNING                        4
+#define LOGLEVEL_NOTICE                         5
+#define LOGLEVEL_INFO                           6
+#define LOGLEVEL_DEBUG                          7
+
+/* Level of a printk() without a prefix */
+#define LOGLEVEL_DEFAULT                        LOGLEVEL_WARNING
+
+#define KERN_SOH                                "\001"
+#define KERN_EMERG                              KERN_SOH "0"
+#define KERN_ALERT                              KERN_SOH "1"
+#define KERN_CRIT                               KERN_SOH "2"
+#define KERN_ERR                                KERN_SOH "3"
+#define KERN_WARNING                            KERN_SOH "4"
+#define KERN_NOTICE                             KERN_SOH "5"
+#define KERN_INFO                               KERN_SOH "6"
+#define KERN_DEBUG                              KERN_SOH "7"
+
+/* Least severe level built in at all; pr_* calls past it compile to nothing.
+ * e.g. make KFLAGS=-DPRINTK_COMPILE_LEVEL=7 for debug messages */
+#ifndef PRINTK_COMPILE_LEVEL
+#define PRINTK_COMPILE_LEVEL                    LOGLEVEL_INFO
+#endif
+
+/* Least severe level printed at boot, until loglevel= on the command line */
+#define PRINTK_CONSOLE_LEVEL                    LOGLEVEL_INFO
+
+#define LOG_BUF_LEN                             (1 << 14)
+#define LOG_LINE_MAX                            256     /* Longer is cut */
+
+/* Each *_ratelimited() call site prints a burst of messages, then one more
+ * per refill period; the rest are counted and reported with the next one */
+#define PRINTK_RATELIMIT_BURST                  10
+#define PRINTK_RATELIMIT_REFILL                 50      /* PIT ticks/message */
+
+/**
+ * struct printk_ratelimit - token bucket for one call site
+ * @stamp: PIT tick the bucket was last refilled up to
+ * @tokens: Messages that may print right now
+ * @suppressed: Messages dropped since the last one printed
+ */
+struct printk_ratelimit {
+        uint64_t stamp;
+        uint32_t tokens;
+        uint32_t suppressed;
+};
+
+#define PRINTK_RATELIMIT_INIT                   {0, PRINTK_RATELIMIT_BURST, 0}
+
+int vsnprintk(char * buf, size_t size, const char * fmt, va_list args);
+int snprintk(char * buf, size_t size, const char * fmt, ...)
+        __attribute__((format (printf, 3, 4)));
 int printk(const char * fmt, ...) __attribute__((format (printf, 1, 2)));
+void printk_echo(const char * text, int len);
+void printk_drain(void);
+void printk_flush(void);
+void printk_wait(int len);
+void printk_serial_hold(int hold);
+void printk_async(void);
+void printk_cmdline(const char * cmdline);
+int printk_ratelimit(struct printk_ratelimit * rs, const char * func);
+
+extern struct static_key printk_debug_key;
+
+#define printk_level(level, fmt, ...)                                          \
+        do {                                                                   \
+                if ((level) <= PRINTK_COMPILE_LEVEL)                           \
+                        printk(fmt, ##__VA_ARGS__);                            \
+        } while (0)
+
+#define pr_emerg(fmt, ...)                                                     \
+        printk_level(LOGLEVEL_EMERG, KERN_EMERG fmt, ##__VA_ARGS__)
+#define pr_alert(fmt, ...)                                                     \
+        printk_level(LOGLEVEL_ALERT, KERN_ALERT fmt, ##__VA_ARGS__)
+#define pr_crit(fmt, ...)                                                      \
+        printk_level(LOGLEVEL_CRIT, KERN_CRIT fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)                                                       \
+        printk_level(LOGLEVEL_ERR, KERN_ERR fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)                                                      \
+        printk_level(LOGLEVEL_WARNING, KERN_WARNING fmt, ##__VA_ARGS__)
+#define pr_notice(fmt, ...)                                                    \
+        printk_level(LOGLEVEL_NOTICE, KERN_NOTICE fmt, ##__VA_ARGS__)
+#define pr_info(fmt, ...)                                                      \
+        printk_level(LOGLEVEL_INFO, KERN_INFO fmt, ##__VA_ARGS__)
+
+/* Debug messages that are built in sit behind a static key, on only while the
+ * console level lets them through, so they cost nothing on hot paths */
+#define pr_debug(fmt, ...)                                                     \
+        do {                                                                   \
+                if (LOGLEVEL_DEBUG <= PRINTK_COMPILE_LEVEL                     \
+                                && static_key_false(&printk_debug_key))        \
+                        printk(KERN_DEBUG fmt, ##__VA_ARGS__);                 \
+        } while (0)
+
+/* Same as printk_level(), but each call site goes through its own bucket so
+ * a storm of the same error can't swamp the consoles */
+#define printk_ratelimited(level, fmt, ...)                                    \
+        do {                                                                   \
+                static struct printk_ratelimit _rs = PRINTK_RATELIMIT_INIT;    \
+                                                                               \
+                if ((level) <= PRINTK_COMPILE_LEVEL                            \
+                                && printk_ratelimit(&_rs, __func__))           \
+                        printk(fmt, ##__VA_ARGS__);                            \
+        } while (0)
+
+#define pr_err_ratelimited(fmt, ...)                                           \
+        printk_ratelimited(LOGLEVEL_ERR, KERN_ERR fmt, ##__VA_ARGS__)
+#define pr_warn_ratelimited(fmt, ...)                                          \
+        printk_ratelimited(LOGLEVEL_WARNING, KERN_WARNING fmt, ##__VA_ARGS__)
+#define pr_info_ratelimited(fmt, ...)                                          \
+        printk_ratelimited(LOGLEVEL_INFO, KERN_INFO fmt, ##__VA_ARGS__)
 
 #endif /* #ifndef PRINTK_H */
@@ -10,11 +10,14 @@
 #include "port_io.h"
 #include "printk.h"
 #include "ps2.h"
+#include "trace.h"
+#include "vt.h"
 
 /* TODO Make timeouts for all polling in this file */
 
 uint8_t lshift = 0;
 uint8_t rshift = 0;
+uint8_t lalt = 0;
 uint8_t caps_lock = 0;
 uint8_t scroll_lock = 0;
 uint8_t num_lock = 1;
@@ -96,16 +99,19 @@ const char scanmap_shift[] = {
 /**
  * ps2_pic_handle() - Small utility to handle PS2 PIC interrupts
  * 
- * VGA display should probably be somewhere else, but that will come with full
- * multithreaded PS2 driver. 
+ * Echoes to the foreground virtual console for now; input should really go
+ * to whoever reads that console, but that will come with full multithreaded
+ * PS2 driver.
  * 
  */
 void ps2_pic_handle()
 {
         char character;
 
-        if((character = get_char()))
-                printk("%c", character);
+        if((character = get_char())) {
+                trace(KEYBOARD, (uint8_t)character);
+                VT_input(character);
+        }
 
         return;
 }
@@ -167,6 +173,33 @@ char get_char()
         case SCAN_RIGHT_SHIFT:
                         rshift = 1;
 
+                        return '\0';
+        case SCAN_LEFT_ALT:
+                        lalt = 1;
+
+                        return '\0';
+        case SCAN_F1:
+        case SCAN_F2:
+        case SCAN_F3:
+        case SCAN_F4:
+                        /* Alt+F1 to F4 pick a virtual console */
+                        if (lalt)
+                                VT_switch(character == SCAN_F1 ? 0
+                                        : character == SCAN_F2 ? 1
+                                        : character == SCAN_F3 ? 2 : 3);
+
+                        return '\0';
+        case SCAN_F11:
+                        /* Alt+F11 prints the newest trace events */
+                        if (lalt)
+                                trace_request(TRACE_REQUEST_DUMP);
+
+                        return '\0';
+        case SCAN_F12:
+                        /* Alt+F12 sends the whole trace to serial */
+                        if (lalt)
+                                trace_request(TRACE_REQUEST_EXPORT);
+
                         return '\0';
         case SCAN_ENTER:
                         return '\n';
@@ -190,6 +223,10 @@ char get_char()
                         case SCAN_RIGHT_SHIFT:
                                 rshift = 0;
 
+                                return '\0';
+                        case SCAN_LEFT_ALT:
+                                lalt = 0;
+
                                 return '\0';
                         }
 
@@ -201,8 +238,18 @@ char get_char()
                          * number of bytes */
                         character = read_keyboard_b();
 
-                        if (character == SCAN_RELEASE)
-                                character = read_keyboard_b();
+                        if (character == SCAN_RELEASE) {
+                                read_keyboard_b();
+                                return '\0';
+                        }
+
+                        /* Shift+PgUp/PgDn scroll the console */
+                        if (lshift | rshift) {
+                                if (character == SCAN_EXT_PAGE_UP)
+                                        VT_scroll(1);
+                                else if (character == SCAN_EXT_PAGE_DOWN)
+                                        VT_scroll(-1);
+                        }
 
                         return '\0';
         default:
@@ -45,6 +45,12 @@
 #define PS2_KEYBOARD_ACK                        0xFA
 #define PS2_KEYBOARD_SELF_TEST_PASS             0xAA
 
+#define SCAN_F1                                 0x05
+#define SCAN_F2                                 0x06
+#define SCAN_F3                                 0x04
+#define SCAN_F4                                 0x0C
+#define SCAN_F11                                0x78
+#define SCAN_F12                                0x07
 #define SCAN_TAB                                0x0D
 #define SCAN_LEFT_ALT                           0x11
 #define SCAN_LEFT_SHIFT                         0x12
@@ -60,6 +66,10 @@
 #define SCAN_RELEASE                            0xF0
 #define SCAN_MULTI_BYTE                         0xE0
 
+/* Second byte after SCAN_MULTI_BYTE */
+#define SCAN_EXT_PAGE_DOWN                      0x7A
+#define SCAN_EXT_PAGE_UP                        0x7D
+
 struct ps2_configuration {
         uint8_t port1_interrupt:1;
         uint8_t port2_interrupt:1;
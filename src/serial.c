@@ -12,8 +12,8 @@
 #include "irq.h"
 #include "port_io.h"
 #include "serial.h"
+#include "trace.h"
 
-static uint8_t tx_fifo_size;
 static char tx_buff[SERIAL_TX_BUFF_LEN];
 static char * produce = NULL, * consume = NULL;
 
@@ -33,7 +33,7 @@ static int tx_reg_empty()
  * check if we have data to write
  *      no->exit
  * check if tx reg is empty 
- *      yes->write up to 1 byte to transmitter
+ *      yes->write up to a FIFO's worth of bytes to transmitter
  * 
  * we don't need to check IIR?
  * 
@@ -44,14 +44,23 @@ void serial_pic_handle()
         if (produce == consume)
                 return;
         
-        /* If we do, check if transmitter is ready */
+        /* If we do, check if transmitter is ready; once it is the whole TX
+         * FIFO is empty, so fill it rather than take an IRQ per byte */
         if (tx_reg_empty()) {
-                outb(SERIAL_IO_COM1, *consume);
+                int i;
 
-                /* Increment consume pointer */
-                consume++;
-                if(consume >= tx_buff + SERIAL_TX_BUFF_LEN)
-                        consume = tx_buff;
+                for (i = 0; i < SERIAL_TX_FIFO_SIZE && consume != produce;
+                                i++) {
+                        outb(SERIAL_IO_COM1, *consume);
+
+                        /* Increment consume pointer */
+                        consume++;
+                        if(consume >= tx_buff + SERIAL_TX_BUFF_LEN)
+                                consume = tx_buff;
+                }
+
+                trace(SERIAL_TX, i, (produce - consume + SERIAL_TX_BUFF_LEN)
+                        % SERIAL_TX_BUFF_LEN);
         }
         
         return;
@@ -78,11 +87,10 @@ void SER_init()
         outb(SERIAL_IO_COM1 + SERIAL_LINE_CONTROL_REG,
                 (SERIAL_8_BIT_CHAR | SERIAL_PARITY_NONE) & ~SERIAL_STOP_BITS);
 
-        /* Enable FIFO, clear, set 14 byte threshold */
+        /* Enable FIFO, clear, set 14 byte receive threshold */
         outb(SERIAL_IO_COM1 + SERIAL_FIFO_CONTROL_REG,
                 SERIAL_ENABLE_FIFO | SERIAL_CLEAR_RX_FIFO |
                 SERIAL_CLEAR_TX_FIFO | SERIAL_FIFO_14B);
-        tx_fifo_size = 14;
 
         /* Enable IRQs, set RTS/DSR */
         outb(SERIAL_IO_COM1 + SERIAL_MODEM_CONTROL_REG,
@@ -117,6 +125,8 @@ void SER_init()
  * 
  * Context: ISR safe
  * 
+ * Only writes as much as fits; the rest is left to the caller.
+ * 
  * TODO: define different error codes for all failures
  * 
  * @return number of bytes written on success, -1 on failure
@@ -125,6 +135,7 @@ int SER_write(const char * buff, int len)
 {
         uint8_t enable_ints = 0;
         int ret = 0;
+        int space;
         uint8_t restart = 0;
 
         if (interrupts_enabled()) {
@@ -143,15 +154,21 @@ int SER_write(const char * buff, int len)
         if(produce == consume)
                 restart = 1;
 
+        /* One slot stays empty so a full buffer doesn't look empty */
+        space = (consume - produce + SERIAL_TX_BUFF_LEN - 1)
+                % SERIAL_TX_BUFF_LEN;
+        if (len > space)
+                len = space;
+
         for (int i = 0; i < len; i++) {
                 *produce = buff[i];
 
-                /* Increment producer; if we pass the consumer we will loose 
-                 * the whole buffer but should't break anything */
                 produce++;
                 if(produce >= tx_buff + SERIAL_TX_BUFF_LEN)
                         produce = tx_buff;
         }
+
+        ret = len;
         
 exit:
         if(restart)
@@ -159,4 +176,33 @@ exit:
         if(enable_ints)
                 STI;
         return ret;
-}
\ No newline at end of file
+}
+
+/**
+ * SER_flush() - push out everything buffered by polling the transmitter
+ * 
+ * Context: for panics; works with interrupts off, and waits as long as the
+ *      buffer takes to send
+ * 
+ */
+void SER_flush()
+{
+        uint8_t enable_ints = 0;
+
+        if (interrupts_enabled()) {
+                CLI;
+                enable_ints = 1;
+        }
+
+        while (produce && produce != consume) {
+                while (!tx_reg_empty())
+                        ;
+
+                serial_pic_handle();
+        }
+
+        if(enable_ints)
+                STI;
+
+        return;
+}
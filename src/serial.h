@@ -9,7 +9,11 @@
 #ifndef SERIAL_H
 #define SERIAL_H                                1
 
-#define SERIAL_TX_BUFF_LEN                      64
+#define SERIAL_TX_BUFF_LEN                      1024
+
+/* Bytes the 16550 transmit FIFO holds; SERIAL_FIFO_14B only sets when the
+ * receive side interrupts */
+#define SERIAL_TX_FIFO_SIZE                     16
 
 #define SERIAL_IO_COM1                          0x03F8
 #define SERIAL_IO_COM2                          0x02F8
@@ -108,5 +112,6 @@
 void serial_pic_handle(void);
 void SER_init(void);
 int SER_write(const char *, int);
+void SER_flush(void);
 
 #endif /* #ifndef SERIAL_H */
\ No newline at end of file
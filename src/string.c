@@ -9,12 +9,259 @@
 #include <stddef.h>
 #include <stdint.h>
 
-/*
+#include "cpu.h"
+#include "mm.h"
+
+/* Below STRING_SMALL bytes, plain word moves beat any rep setup; from
+ * STRING_REP_MIN up, rep movsb/stosb wins on CPUs with ERMS */
+#define STRING_SMALL 32
+#define STRING_REP_MIN 256
+
+/* From here up a fill or copy is big enough to push the kernel's working set
+ * out of cache, so it goes around it with streaming stores */
+#define STRING_NT_MIN (32 * 1024)
+
+/* 8 bytes at any alignment; x86 doesn't mind unaligned loads and stores */
+typedef uint64_t __attribute__((may_alias, aligned(1))) uword_t;
+
+static inline void rep_movsb(void * dst, const void * src, size_t n)
+{
+        asm volatile("rep movsb"
+                : "+D"(dst), "+S"(src), "+c"(n)
+                :
+                : "memory");
+}
+
+static inline void rep_stosb(void * dst, uint8_t c, size_t n)
+{
+        asm volatile("rep stosb"
+                : "+D"(dst), "+c"(n)
+                : "a"(c)
+                : "memory");
+}
+
+/**
+ * copy_forward() - copy low to high, 32 then 8 then 1 byte at a time
+ * @d: Destination
+ * @s: Source
+ * @n: Number of bytes
+ *
+ * Each group of words is loaded before any of it is stored, so this is also
+ * safe for overlapping areas with d below s.
+ *
+ * Return: void
+ */
+static inline void copy_forward(uint8_t * d, const uint8_t * s, size_t n)
+{
+        for(; n >= 32; n -= 32, d += 32, s += 32) {
+                uint64_t w0 = ((uword_t *)s)[0], w1 = ((uword_t *)s)[1];
+                uint64_t w2 = ((uword_t *)s)[2], w3 = ((uword_t *)s)[3];
+
+                ((uword_t *)d)[0] = w0;
+                ((uword_t *)d)[1] = w1;
+                ((uword_t *)d)[2] = w2;
+                ((uword_t *)d)[3] = w3;
+        }
+
+        for(; n >= 8; n -= 8, d += 8, s += 8)
+                *(uword_t *)d = *(uword_t *)s;
+
+        for(; n; n--)
+                *d++ = *s++;
+
+        return;
+}
+
+/**
+ * copy_backward() - copy high to low, for overlapping areas with d above s
+ * @d: Destination
+ * @s: Source
+ * @n: Number of bytes
+ *
+ * Return: void
+ */
+static inline void copy_backward(uint8_t * d, const uint8_t * s, size_t n)
+{
+        d += n;
+        s += n;
+
+        for(; n >= 32; n -= 32) {
+                uint64_t w0, w1, w2, w3;
+
+                d -= 32;
+                s -= 32;
+
+                w3 = ((uword_t *)s)[3];
+                w2 = ((uword_t *)s)[2];
+                w1 = ((uword_t *)s)[1];
+                w0 = ((uword_t *)s)[0];
+
+                ((uword_t *)d)[3] = w3;
+                ((uword_t *)d)[2] = w2;
+                ((uword_t *)d)[1] = w1;
+                ((uword_t *)d)[0] = w0;
+        }
+
+        for(; n >= 8; n -= 8) {
+                d -= 8;
+                s -= 8;
+                *(uword_t *)d = *(uword_t *)s;
+        }
+
+        for(; n; n--)
+                *--d = *--s;
+
+        return;
+}
+
+/**
+ * nt_fill() - fill with streaming stores that bypass the cache
+ * @d: Destination, 8 byte aligned
+ * @pattern: Word to store
+ * @n: Number of bytes, a multiple of 32
+ *
+ * movnti works from general registers, so this needs no kernel_fpu_begin().
+ * Callers must sfence before anything depends on the stores.
+ *
+ * Return: void
+ */
+static inline void nt_fill(uint8_t * d, uint64_t pattern, size_t n)
+{
+        for(; n; n -= 32, d += 32)
+                asm volatile("movnti %1, 0(%0)\n\t"
+                        "movnti %1, 8(%0)\n\t"
+                        "movnti %1, 16(%0)\n\t"
+                        "movnti %1, 24(%0)"
+                        :
+                        : "r"(d), "r"(pattern)
+                        : "memory");
+
+        return;
+}
+
+/**
+ * nt_copy() - copy with streaming stores that bypass the cache
+ * @d: Destination, 8 byte aligned
+ * @s: Source
+ * @n: Number of bytes, a multiple of 32
+ *
+ * Like copy_forward(), safe for overlapping areas with d below s.  Callers
+ * must sfence before anything depends on the stores.
+ *
+ * Return: void
+ */
+static inline void nt_copy(uint8_t * d, const uint8_t * s, size_t n)
+{
+        for(; n; n -= 32, d += 32, s += 32) {
+                uint64_t w0 = ((uword_t *)s)[0], w1 = ((uword_t *)s)[1];
+                uint64_t w2 = ((uword_t *)s)[2], w3 = ((uword_t *)s)[3];
+
+                asm volatile("movnti %1, 0(%0)\n\t"
+                        "movnti %2, 8(%0)\n\t"
+                        "movnti %3, 16(%0)\n\t"
+                        "movnti %4, 24(%0)"
+                        :
+                        : "r"(d), "r"(w0), "r"(w1), "r"(w2), "r"(w3)
+                        : "memory");
+        }
+
+        return;
+}
+
+static inline void sfence(void)
+{
+        asm volatile("sfence" : : : "memory");
+}
+
+/**
+ * clear_page() - zero a page without pulling it into the cache
+ * @page: Page aligned address
+ *
+ * Return: void
+ */
+void clear_page(void * page)
+{
+        nt_fill(page, 0, MM_PF_SIZE);
+        sfence();
+
+        return;
+}
+
+/**
+ * copy_page() - copy a page without pulling the destination into the cache
+ * @dst: Page aligned destination
+ * @src: Page aligned source
  *
+ * Return: void
+ */
+void copy_page(void * dst, const void * src)
+{
+        nt_copy(dst, src, MM_PF_SIZE);
+        sfence();
+
+        return;
+}
+
+/**
+ * memset() - fill memory with a constant byte
+ * @dst: pointer to memory region to fill
+ * @c: byte to fill with
+ * @n: number of bytes to fill
+ *
+ * Short fills use word stores.  Long ones use rep stosb when the CPU has fast
+ * string support, otherwise rep stosq from an aligned start.  Fills past
+ * STRING_NT_MIN use streaming stores so they don't flush the cache.
+ *
+ * Return: pointer to dst
  */
 void * memset(void * dst, int c, size_t n)
 {
-        return NULL;
+        uint64_t pattern = 0x0101010101010101 * (uint8_t)c;
+        uint8_t * d = dst;
+
+        if(n >= STRING_NT_MIN) {
+                size_t head = -(uintptr_t)d & 7, body;
+
+                *(uword_t *)d = pattern;
+                d += head;
+                n -= head;
+                body = n & ~(size_t)31;
+
+                nt_fill(d, pattern, body);
+                sfence();
+                d += body;
+                n -= body;
+
+                for(; n >= 8; n -= 8, d += 8)
+                        *(uword_t *)d = pattern;
+
+                for(; n; n--)
+                        *d++ = c;
+        } else if(n >= STRING_REP_MIN && CPU_has(CPU_ERMS)) {
+                rep_stosb(d, c, n);
+        } else if(n >= STRING_REP_MIN) {
+                size_t head = -(uintptr_t)d & 7, words;
+
+                *(uword_t *)d = pattern;
+                d += head;
+                n -= head;
+                words = n / 8;
+
+                asm volatile("rep stosq"
+                        : "+D"(d), "+c"(words)
+                        : "a"(pattern)
+                        : "memory");
+
+                rep_stosb(d, c, n % 8);
+        } else {
+                for(; n >= 8; n -= 8, d += 8)
+                        *(uword_t *)d = pattern;
+
+                for(; n; n--)
+                        *d++ = c;
+        }
+
+        return dst;
 }
 
 /**
@@ -24,19 +271,106 @@ void * memset(void * dst, int c, size_t n)
  * @n: number of bytes to copy
  *
  * Copies n bytes from source memory area to dst.  Areas must not overlap.
+ * Short copies use word moves; long ones use rep movsb with ERMS (or any
+ * size past the small cutoff with FSRM), otherwise rep movsq.  Copies past
+ * STRING_NT_MIN use streaming stores so they don't flush the cache.
  *
  * Return: pointer to dest on success
  */
 void * memcpy(void * dst, const void * src, size_t n)
 {
-        int i;
+        uint8_t * d = dst;
+        const uint8_t * s = src;
+
+        if(n >= STRING_NT_MIN) {
+                size_t head = -(uintptr_t)d & 7, body;
+
+                copy_forward(d, s, head);
+                d += head;
+                s += head;
+                n -= head;
+                body = n & ~(size_t)31;
+
+                nt_copy(d, s, body);
+                sfence();
 
-        for(i = 0; i < n; i++)
-                ((uint8_t *)dst)[i] = ((uint8_t *)src)[i];
+                copy_forward(d + body, s + body, n - body);
+        } else if((n >= STRING_REP_MIN && CPU_has(CPU_ERMS))
+                        || (n >= STRING_SMALL && CPU_has(CPU_FSRM))) {
+                rep_movsb(d, s, n);
+        } else if(n >= STRING_REP_MIN) {
+                size_t head = -(uintptr_t)d & 7, words;
+
+                /* Align the destination, stores are what split lines hurt */
+                copy_forward(d, s, head);
+                d += head;
+                s += head;
+                n -= head;
+                words = n / 8;
+
+                asm volatile("rep movsq"
+                        : "+D"(d), "+S"(s), "+c"(words)
+                        :
+                        : "memory");
+
+                copy_forward(d, s, n % 8);
+        } else {
+                copy_forward(d, s, n);
+        }
+
+        return dst;
+}
+
+/**
+ * memmove() - copy memory area that may overlap
+ * @dst: pointer to destination memory region
+ * @src: pointer to source memory region
+ * @n: number of bytes to copy
+ *
+ * Forward copies, including rep movs, are safe whenever dst is below src, so
+ * only a destination inside the source needs the backward copy.
+ *
+ * Return: pointer to dst
+ */
+void * memmove(void * dst, const void * src, size_t n)
+{
+        if(dst == src)
+                return dst;
+
+        if((uintptr_t)dst - (uintptr_t)src >= n)
+                return memcpy(dst, src, n);
+
+        copy_backward(dst, src, n);
 
         return dst;
 }
 
+/**
+ * memcmp() - compare memory areas
+ * @s1: first memory region
+ * @s2: second memory region
+ * @n: number of bytes to compare
+ *
+ * Skips equal words eight bytes at a time, then finds the first differing
+ * byte.
+ *
+ * Return: <0, 0 or >0 as s1 sorts before, the same as or after s2
+ */
+int memcmp(const void * s1, const void * s2, size_t n)
+{
+        const uint8_t * a = s1, * b = s2;
+
+        for(; n >= 8 && *(uword_t *)a == *(uword_t *)b; n -= 8, a += 8, b += 8)
+                ;
+
+        for(; n; n--, a++, b++) {
+                if(*a != *b)
+                        return *a - *b;
+        }
+
+        return 0;
+}
+
 /*
  *
  */
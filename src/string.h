@@ -13,6 +13,10 @@
 
 void * memset(void * dst, int c, size_t n);
 void * memcpy(void * dst, const void * src, size_t n);
+void * memmove(void * dst, const void * src, size_t n);
+int memcmp(const void * s1, const void * s2, size_t n);
+void clear_page(void * page);
+void copy_page(void * dst, const void * src);
 size_t strlen(const char * s);
 char * strcpy(char * dst, const char * src);
 int strcmp(const char * s1, const char * s2);
@@ -0,0 +1,380 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/trace.c
+ *
+ * Binary event tracing
+ *
+ * Trace points record a time stamp, the CPU, an event id and four raw
+ * arguments into a per-CPU ring, overwriting the oldest events once full.
+ * Nothing gets formatted until trace_dump() prints the ring through printk,
+ * or trace_export() sends it raw over serial for hosted/tracedump to decode.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu.h"
+#include "irq.h"
+#include "printk.h"
+#include "serial.h"
+#include "string.h"
+#include "trace.h"
+
+/**
+ * struct trace_buf - one CPU's ring
+ * @head: Events ever recorded; the next one goes at head % TRACE_BUF_EVENTS
+ * @events: The ring
+ */
+struct trace_buf {
+        uint64_t head;
+        struct trace_event events[TRACE_BUF_EVENTS];
+} __attribute__((aligned(64)));
+
+#define TRACE_INFO(name, format)                {#name, format},
+static const struct {
+        const char * name;
+        const char * format;
+} trace_info[TRACE_NUM_EVENTS] = {
+        TRACE_EVENTS(TRACE_INFO)
+};
+#undef TRACE_INFO
+
+struct static_key trace_keys[TRACE_NUM_EVENTS];
+
+static struct trace_buf trace_bufs[TRACE_NCPUS];
+
+/**
+ * cpu_id() - index of the CPU we're running on
+ *
+ * Return: Always 0 until more CPUs get brought up
+ */
+static inline int cpu_id(void)
+{
+        return 0;
+}
+
+/**
+ * trace_record() - store an event; use trace() instead of calling this
+ * @id: Event id
+ * @args: Event arguments
+ *
+ * Context: ISR safe; an interrupt that records in the middle of this just
+ *      takes the next slot
+ *
+ * Return: void
+ */
+void trace_record(int id, const uint64_t args[4])
+{
+        struct trace_buf * buf = trace_bufs + cpu_id();
+        struct trace_event * e;
+        uint64_t slot;
+
+        slot = __atomic_fetch_add(&buf->head, 1, __ATOMIC_RELAXED);
+        e = buf->events + slot % TRACE_BUF_EVENTS;
+
+        e->tsc = rdtsc();
+        e->cpu = cpu_id();
+        e->id = id;
+        e->args[0] = args[0];
+        e->args[1] = args[1];
+        e->args[2] = args[2];
+        e->args[3] = args[3];
+
+        return;
+}
+
+/**
+ * trace_enable() - turn one event on or off
+ * @id: Event id
+ * @on: Nonzero to record it
+ *
+ * Return: void
+ */
+void trace_enable(int id, int on)
+{
+        if (id < 0 || id >= TRACE_NUM_EVENTS)
+                return;
+
+        if (on)
+                static_key_enable(trace_keys + id);
+        else
+                static_key_disable(trace_keys + id);
+
+        return;
+}
+
+/**
+ * trace_enable_all() - turn every event on or off
+ * @on: Nonzero to record them
+ *
+ * Return: void
+ */
+void trace_enable_all(int on)
+{
+        for (int i = 0; i < TRACE_NUM_EVENTS; i++)
+                trace_enable(i, on);
+
+        return;
+}
+
+/*
+ * Reading the rings while trace points keep firing would mix new events into
+ * what's being read, so dump and export switch everything off around it.
+ */
+static void trace_pause(uint8_t saved[TRACE_NUM_EVENTS])
+{
+        for (int i = 0; i < TRACE_NUM_EVENTS; i++)
+                saved[i] = trace_keys[i].enabled;
+
+        trace_enable_all(0);
+
+        return;
+}
+
+static void trace_resume(const uint8_t saved[TRACE_NUM_EVENTS])
+{
+        for (int i = 0; i < TRACE_NUM_EVENTS; i++)
+                trace_enable(i, saved[i]);
+
+        return;
+}
+
+/**
+ * trace_dump() - format and print the newest events
+ * @n: Events to print per CPU, at most TRACE_BUF_EVENTS
+ *
+ * Recording is paused while this runs.  Times are TSC ticks since the
+ * first event printed.  The log ring is much smaller than a full dump, so
+ * every TRACE_DUMP_BATCH lines this waits for the timer tick to drain it
+ * rather than dropping most of it.
+ *
+ * Context: task context with interrupts on, see trace_request()
+ *
+ * Return: void
+ */
+void trace_dump(int n)
+{
+        uint8_t saved[TRACE_NUM_EVENTS];
+
+        trace_pause(saved);
+
+        if (n > TRACE_BUF_EVENTS)
+                n = TRACE_BUF_EVENTS;
+
+        for (int cpu = 0; cpu < TRACE_NCPUS; cpu++) {
+                struct trace_buf * buf = trace_bufs + cpu;
+                uint64_t head = buf->head;
+                uint64_t first = head > n ? head - n : 0;
+                uint64_t base = buf->events[first % TRACE_BUF_EVENTS].tsc;
+
+                pr_info("TRACE: cpu %d, %lu events, last %lu\n", cpu, head,
+                        head - first);
+
+                for (uint64_t i = first; i < head; i++) {
+                        struct trace_event * e;
+                        char text[96];
+
+                        e = buf->events + i % TRACE_BUF_EVENTS;
+
+                        if (e->id >= TRACE_NUM_EVENTS)
+                                continue;
+
+                        if ((i - first) % TRACE_DUMP_BATCH == 0)
+                                printk_wait(TRACE_DUMP_BATCH * LOG_LINE_MAX);
+
+                        snprintk(text, sizeof(text), trace_info[e->id].format,
+                                e->args[0], e->args[1], e->args[2], e->args[3]);
+                        pr_info("    %12lu %-12s %s\n", e->tsc - base,
+                                trace_info[e->id].name, text);
+                }
+        }
+
+        trace_resume(saved);
+
+        return;
+}
+
+#ifndef FRAGARIA_HOSTED
+static void export_bytes(const void * data, int len)
+{
+        const char * p = data;
+
+        while (len > 0) {
+                int n = SER_write(p, len);
+
+                /* Serial isn't up */
+                if (n < 0)
+                        return;
+
+                p += n;
+                len -= n;
+
+                /* The transmit interrupt makes room */
+                if (len)
+                        asm("hlt");
+        }
+
+        return;
+}
+
+/**
+ * trace_export() - send every CPU's ring raw over serial
+ *
+ * Recording is paused and printk is held off serial for the duration, so
+ * no text lands in the middle; the bytes go through the transmit ring like
+ * anything else, with this waiting in hlt whenever it's full.  The stream
+ * is:
+ *
+ *   TRACE_EXPORT_MAGIC
+ *   uint32_t events, cpus, sizeof(struct trace_event)
+ *   per event id: uint8_t name length, format length; name; format
+ *   per CPU: uint64_t count; count struct trace_event, oldest first
+ *
+ * all little endian.  hosted/tracedump turns it back into text.
+ *
+ * Context: task context with interrupts on, see trace_request()
+ *
+ * Return: void
+ */
+void trace_export(void)
+{
+        uint8_t saved[TRACE_NUM_EVENTS];
+        uint32_t header[3] = {
+                TRACE_NUM_EVENTS, TRACE_NCPUS, sizeof(struct trace_event)
+        };
+
+        if (!interrupts_enabled())
+                return;
+
+        trace_pause(saved);
+        printk_serial_hold(1);
+
+        export_bytes(TRACE_EXPORT_MAGIC, 8);
+        export_bytes(header, sizeof(header));
+
+        for (int i = 0; i < TRACE_NUM_EVENTS; i++) {
+                uint8_t len[2];
+
+                for (len[0] = 0; trace_info[i].name[len[0]]; len[0]++)
+                        ;
+                for (len[1] = 0; trace_info[i].format[len[1]]; len[1]++)
+                        ;
+
+                export_bytes(len, 2);
+                export_bytes(trace_info[i].name, len[0]);
+                export_bytes(trace_info[i].format, len[1]);
+        }
+
+        for (int cpu = 0; cpu < TRACE_NCPUS; cpu++) {
+                struct trace_buf * buf = trace_bufs + cpu;
+                uint64_t head = buf->head;
+                uint64_t count = head < TRACE_BUF_EVENTS
+                        ? head : TRACE_BUF_EVENTS;
+
+                export_bytes(&count, sizeof(count));
+
+                for (uint64_t i = head - count; i < head; i++)
+                        export_bytes(buf->events + i % TRACE_BUF_EVENTS,
+                                sizeof(struct trace_event));
+        }
+
+        printk_serial_hold(0);
+        trace_resume(saved);
+
+        return;
+}
+
+static int trace_requests;
+
+/**
+ * trace_request() - ask for a dump or export at the next trace_poll()
+ * @what: TRACE_REQUEST_DUMP and/or TRACE_REQUEST_EXPORT
+ *
+ * Both take a long time at serial speeds, too long for an interrupt
+ * handler; this is what the keyboard handler calls instead.
+ *
+ * Context: ISR safe
+ *
+ * Return: void
+ */
+void trace_request(int what)
+{
+        __atomic_fetch_or(&trace_requests, what, __ATOMIC_RELAXED);
+
+        return;
+}
+
+/**
+ * trace_poll() - carry out what trace_request() asked for
+ *
+ * Context: task context with interrupts on; the idle loop calls this
+ *
+ * Return: void
+ */
+void trace_poll(void)
+{
+        int what = __atomic_exchange_n(&trace_requests, 0, __ATOMIC_RELAXED);
+
+        if (what & TRACE_REQUEST_DUMP)
+                trace_dump(TRACE_REQUEST_EVENTS);
+        if (what & TRACE_REQUEST_EXPORT)
+                trace_export();
+
+        return;
+}
+#endif /* #ifndef FRAGARIA_HOSTED */
+
+/**
+ * trace_cmdline() - turn on the events named on the boot command line
+ * @cmdline: Command line, words separated by spaces
+ *
+ * Understands trace=all and trace=NAME[,NAME...], with names as in
+ * TRACE_EVENTS, e.g. trace=PAGE_FAULT,KMALLOC.  Unknown names are reported
+ * and skipped.
+ *
+ */
+void trace_cmdline(const char * cmdline)
+{
+        while (*cmdline) {
+                const char * word = cmdline;
+
+                while (*cmdline && *cmdline != ' ')
+                        cmdline++;
+
+                if (cmdline - word > 6 && !memcmp(word, "trace=", 6)) {
+                        const char * name = word + 6;
+
+                        while (name < cmdline) {
+                                const char * end = name;
+                                int len, i;
+
+                                while (end < cmdline && *end != ',')
+                                        end++;
+                                len = end - name;
+
+                                for (i = 0; i < TRACE_NUM_EVENTS; i++) {
+                                        if (strlen(trace_info[i].name) == len
+                                                && !memcmp(trace_info[i].name,
+                                                        name, len))
+                                                break;
+                                }
+
+                                if (len == 3 && !memcmp(name, "all", 3))
+                                        trace_enable_all(1);
+                                else if (i < TRACE_NUM_EVENTS)
+                                        trace_enable(i, 1);
+                                else if (len)
+                                        pr_warn("TRACE: no event %.*s\n",
+                                                len, name);
+
+                                name = end + 1;
+                        }
+                }
+
+                while (*cmdline == ' ')
+                        cmdline++;
+        }
+
+        return;
+}
@@ -0,0 +1,96 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/trace.h
+ *
+ * Header for binary event tracing
+ *
+ */
+
+#ifndef TRACE_H
+#define TRACE_H                                 1
+
+#include <stdint.h>
+
+#include "jump_label.h"
+
+#define TRACE_NCPUS                             1
+#define TRACE_BUF_EVENTS                        4096    /* power of two */
+
+/* trace_dump() lets printk catch up after this many lines */
+#define TRACE_DUMP_BATCH                        16
+
+/* For trace_request() */
+#define TRACE_REQUEST_DUMP                      (1 << 0)
+#define TRACE_REQUEST_EXPORT                    (1 << 1)
+#define TRACE_REQUEST_EVENTS                    64      /* dumped per request */
+
+/* Starts a raw export on serial, see trace_export() */
+#define TRACE_EXPORT_MAGIC                      "FRAGTRC1"
+
+/*
+ * Every trace point, as X(name, format).  The format is only used when the
+ * buffer is dumped and gets the four arguments as unsigned longs.
+ */
+#define TRACE_EVENTS(X)                                                        \
+        X(PAGE_FAULT,   "page fault at %lx, error %lx")                        \
+        X(PT_ALLOC,     "new P%lu table %lx")                                  \
+        X(FRAME_ALLOC,  "frame %lx allocated")                                 \
+        X(FRAME_FREE,   "frame %lx freed")                                     \
+        X(KMALLOC,      "kmalloc(%lu) = %lx from %lx")                         \
+        X(KFREE,        "kfree(%lx) from %lx")                                 \
+        X(HEAP_GROW,    "heap grows %lu pages to %lx")                         \
+        X(HEAP_TRIM,    "heap trims %lu pages to %lx")                         \
+        X(IRQ_ENTER,    "irq %lx enter, error %lx, rip %lx")                   \
+        X(IRQ_EXIT,     "irq %lx exit")                                        \
+        X(TIMER_TICK,   "tick %lu")                                            \
+        X(SERIAL_TX,    "serial sent %lu bytes, %lu left")                     \
+        X(KEYBOARD,     "key '%c'")
+
+#define TRACE_ID(name, format)                  TRACE_##name,
+enum trace_id {
+        TRACE_EVENTS(TRACE_ID)
+        TRACE_NUM_EVENTS
+};
+#undef TRACE_ID
+
+/**
+ * struct trace_event - one recorded event
+ * @tsc: Time stamp counter when it was recorded
+ * @cpu: CPU that recorded it
+ * @id: Which event, an enum trace_id
+ * @args: Event arguments
+ */
+struct trace_event {
+        uint64_t tsc;
+        uint16_t cpu;
+        uint16_t id;
+        uint32_t reserved;
+        uint64_t args[4];
+};
+
+extern struct static_key trace_keys[TRACE_NUM_EVENTS];
+
+void trace_record(int id, const uint64_t args[4]);
+void trace_enable(int id, int on);
+void trace_enable_all(int on);
+void trace_dump(int n);
+void trace_export(void);
+void trace_request(int what);
+void trace_poll(void);
+void trace_cmdline(const char * cmdline);
+
+/**
+ * trace() - record an event if it's enabled
+ * @name: Event name from TRACE_EVENTS, without the TRACE_ prefix
+ * @...: Up to four arguments, converted to uint64_t; missing ones are 0
+ *
+ * A nop while the event is off; trace_enable() patches it into a jump.
+ */
+#define trace(name, ...)                                                       \
+        do {                                                                   \
+                if (static_key_false(&trace_keys[TRACE_##name]))               \
+                        trace_record(TRACE_##name,                             \
+                                (const uint64_t[4]){__VA_ARGS__});             \
+        } while (0)
+
+#endif /* #ifndef TRACE_H */
@@ -3,42 +3,129 @@
  * fragaria/src/vga.c
  *
  * BIOS VGA interface functions
+ *
+ * Everything is drawn into shadow, a copy of the text window in ordinary
+ * cached RAM, and each row remembers the span of columns changed since the
+ * last VGA_flush().  Flushing copies just those spans to 0xB8000 with
+ * memcpy(), then moves the CRTC start address if the screen scrolled, so a
+ * burst of output costs one pass over the uncached buffer.
  * 
  */
 
 #include <stdint.h>
 
 #include "irq.h"
+#include "port_io.h"
 #include "string.h"
 #include "vga.h"
 
 #define VGA_CONSOLE                             0x0B8000
 
+#define BLANK                   (' ' | VGA_FG(VGA_COLOR_LIGHT_GREY)        \
+                                        | VGA_BG(VGA_COLOR_BLACK))
+
 static uint16_t * vgaBuff = (uint16_t *)VGA_CONSOLE;
+static uint16_t shadow[VGA_WINDOW_CELLS];
 static int cursor = 0;
 
+/* Cell in the window shown at the top left; the screen is the VGA_HEIGHT
+ * rows from here, and cursor counts from here too.  shown is what the CRTC
+ * has been told so far. */
+static int origin = 0, shown = 0;
+
+/* Set once the loader has put the display in a graphics mode; the shadow
+ * keeps being drawn so VGA_text() can hand it over, but 0xB8000 and the
+ * CRTC are left alone */
+static int disabled = 0;
+
+/* Columns [dirty_lo, dirty_hi) of each window row differ from vgaBuff */
+static uint8_t dirty_lo[VGA_WINDOW_ROWS], dirty_hi[VGA_WINDOW_ROWS];
+
+/**
+ * mark_dirty() - note cells of one row that need flushing
+ * @cell: First cell, as an offset into the window
+ * @n: Number of cells, not past the end of the row
+ *
+ * Return: void
+ */
+static void mark_dirty(int cell, int n)
+{
+        int row = cell / VGA_WIDTH, col = cell % VGA_WIDTH;
+
+        if (dirty_hi[row] == 0) {
+                dirty_lo[row] = col;
+                dirty_hi[row] = col + n;
+                return;
+        }
+
+        if (col < dirty_lo[row])
+                dirty_lo[row] = col;
+        if (col + n > dirty_hi[row])
+                dirty_hi[row] = col + n;
+
+        return;
+}
+
+/**
+ * blank_rows() - fill whole rows of the shadow with spaces
+ * @cell: First cell of the first row
+ * @rows: Number of rows
+ *
+ * Return: void
+ */
+static void blank_rows(int cell, int rows)
+{
+        for (int i = 0; i < rows * VGA_WIDTH; i++)
+                shadow[cell + i] = BLANK;
+
+        for (int i = 0; i < rows; i++)
+                mark_dirty(cell + i * VGA_WIDTH, VGA_WIDTH);
+
+        return;
+}
+
+/**
+ * set_start() - point the CRTC at the cell to show at the top left
+ * @cell: Cell offset into the text window
+ *
+ * Return: void
+ */
+static void set_start(int cell)
+{
+        outb(VGA_CRTC_INDEX, VGA_CRTC_START_HI);
+        outb(VGA_CRTC_DATA, cell >> 8);
+        outb(VGA_CRTC_INDEX, VGA_CRTC_START_LO);
+        outb(VGA_CRTC_DATA, cell & 0xFF);
+
+        return;
+}
+
 /**
  * scroll() - small VGA utility; scrolls the BIOS VGA console one line
  *
+ * Moves the start address down a row, so the text already on screen stays
+ * where it is in memory.  Once the next screen would run past the end of
+ * the window the bottom rows get copied back to the start of it, which is
+ * off screen until VGA_flush() switches over.
+ *
  * Return: zero on success
  */
 static int scroll()
 {
-        int i;
-
-        /* Move the bottom 24 rows up one */
-        /* TODO: memcpy is unsafe here(overlapping memory regions), swap for
-         * memmove when kmalloc exists or rewrite memcpy here to guarantee
-         * safety */
-        memcpy(vgaBuff, vgaBuff + VGA_WIDTH, 2 * VGA_WIDTH * (VGA_HEIGHT - 1));
-        
-        /* Wipe the bottom row */
-        for (i = 0; i < VGA_WIDTH; i++) {
-                vgaBuff[VGA_WIDTH * (VGA_HEIGHT - 1) + i] = ' '
-                        | VGA_FG(VGA_COLOR_LIGHT_GREY)
-                        | VGA_BG(VGA_COLOR_BLACK);
+        if (origin + VGA_WIDTH * (VGA_HEIGHT + 1) <= VGA_WINDOW_CELLS) {
+                origin += VGA_WIDTH;
+        } else {
+                memmove(shadow, shadow + origin + VGA_WIDTH,
+                        2 * VGA_WIDTH * (VGA_HEIGHT - 1));
+                origin = 0;
+
+                for (int i = 0; i < VGA_HEIGHT - 1; i++)
+                        mark_dirty(i * VGA_WIDTH, VGA_WIDTH);
         }
 
+        /* Wipe the new bottom row */
+        blank_rows(origin + VGA_WIDTH * (VGA_HEIGHT - 1), 1);
+
         /* Move the cursor up a row */
         cursor = cursor - VGA_WIDTH;
 
@@ -46,30 +133,130 @@ static int scroll()
 }
 
 /**
- * VGA_clear() - clears BIOS VGA console
+ * flush() - copy the dirty parts of the screen out; interrupts must be off
  *
- * Return: zero on success
+ * Rows scrolled off screen are dropped rather than copied; anything that
+ * scrolls back into view gets blanked, and so marked, on the way.
+ *
+ * Return: void
  */
-int VGA_clear()
+static void flush(void)
 {
-        int i;
+        int first = origin / VGA_WIDTH;
 
-        /* Write a space in light grey on black for every character */
-        for (i = 0; i < VGA_WIDTH * VGA_HEIGHT; i++) {
-                vgaBuff[i] = ' ' | VGA_FG(VGA_COLOR_LIGHT_GREY)
-                        | VGA_BG(VGA_COLOR_BLACK);
+        if (disabled)
+                return;
+
+        for (int row = first; row < first + VGA_HEIGHT; row++) {
+                int cell = row * VGA_WIDTH + dirty_lo[row];
+
+                if (dirty_hi[row] == 0)
+                        continue;
+
+                memcpy(vgaBuff + cell, shadow + cell,
+                        2 * (dirty_hi[row] - dirty_lo[row]));
         }
 
-        return 0;
+        memset(dirty_hi, 0, sizeof(dirty_hi));
+
+        if (shown != origin) {
+                set_start(origin);
+                shown = origin;
+        }
+
+        return;
 }
 
 /**
- * VGA_display_char() - write a character to the BIOS VGA console
- * @c: Character to print
+ * VGA_flush() - show everything written to the BIOS VGA console so far
+ *
+ * VGA_write() leaves its output in the shadow buffer; printk calls this
+ * once per drain.
+ *
+ * Return: void
+ */
+void VGA_flush()
+{
+        uint8_t enable_ints = 0;
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        flush();
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * VGA_disable() - stop touching the VGA hardware
+ *
+ * For when the display isn't in text mode.  Output still lands in the
+ * shadow buffer for VGA_text().
+ *
+ * Return: void
+ */
+void VGA_disable()
+{
+        disabled = 1;
+
+        return;
+}
+
+/**
+ * VGA_text() - copy out what's on the screen as text
+ * @buff: Where to put it
+ * @len: Size of buff; VGA_WIDTH * VGA_HEIGHT + VGA_HEIGHT always fits
+ *
+ * Rows above the cursor lose their trailing spaces and end in newlines, and
+ * the cursor's row stops at the cursor, so writing the result to another
+ * console leaves it in the same place.
+ *
+ * Return: number of characters copied
+ */
+int VGA_text(char * buff, int len)
+{
+        uint8_t enable_ints = 0;
+        int ret = 0;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        for (int row = 0; row <= VGA_ROW(cursor); row++) {
+                uint16_t * cells = shadow + origin + row * VGA_WIDTH;
+                int end = VGA_WIDTH;
+
+                /* The cursor's row is copied as is so the cursor lines up */
+                if (row == VGA_ROW(cursor))
+                        end = VGA_COL(cursor);
+                else
+                        while (end > 0 && (cells[end - 1] & 0xFF) == ' ')
+                                end--;
+
+                for (int col = 0; col < end && ret < len; col++)
+                        buff[ret++] = cells[col] & 0xFF;
+
+                if (row < VGA_ROW(cursor) && ret < len)
+                        buff[ret++] = '\n';
+        }
+
+        if (enable_ints)
+                STI;
+
+        return ret;
+}
+
+/**
+ * VGA_clear() - clears BIOS VGA console and homes the cursor
  *
  * Return: zero on success
  */
-int VGA_display_char(char c)
+int VGA_clear()
 {
         uint8_t enable_ints = 0;
         if (interrupts_enabled()) {
@@ -77,6 +264,32 @@ int VGA_display_char(char c)
                 CLI;
         }
 
+        /* Write a space in light grey on black for every character */
+        blank_rows(origin, VGA_HEIGHT);
+        cursor = 0;
+
+        /* The loader may have left the start address anywhere */
+        if (!disabled) {
+                set_start(origin);
+                shown = origin;
+        }
+
+        flush();
+
+        if (enable_ints)
+                STI;
+
+        return 0;
+}
+
+/**
+ * put_char() - write a character at the cursor; interrupts must be off
+ * @c: Character to print
+ *
+ * Return: void
+ */
+static void put_char(char c)
+{
         if (c == '\n') {
                 cursor = (VGA_ROW(cursor) + 1) * VGA_WIDTH;
                 if(VGA_ROW(cursor) >= VGA_HEIGHT)
@@ -84,19 +297,67 @@ int VGA_display_char(char c)
         } else if (c == '\r') {
                 cursor = VGA_ROW(cursor) * VGA_WIDTH;
         } else {
-                vgaBuff[cursor] = c | VGA_FG(VGA_COLOR_LIGHT_GREY)
+                shadow[origin + cursor] = c | VGA_FG(VGA_COLOR_LIGHT_GREY)
                         | VGA_BG(VGA_COLOR_BLACK);
+                mark_dirty(origin + cursor, 1);
                 cursor++;
                 if(VGA_ROW(cursor) >= VGA_HEIGHT)
                         scroll();
         }
 
+        return;
+}
+
+/**
+ * VGA_display_char() - write a character to the BIOS VGA console
+ * @c: Character to print
+ *
+ * Return: zero on success
+ */
+int VGA_display_char(char c)
+{
+        uint8_t enable_ints = 0;
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        put_char(c);
+        flush();
+
         if (enable_ints)
                 STI;
 
         return 0;
 }
 
+/**
+ * VGA_write() - write a run of characters to the BIOS VGA console
+ * @buff: Characters to print
+ * @len: Number of characters
+ *
+ * Takes interrupts off once for the whole run instead of per character.
+ * The characters only reach the screen at the next VGA_flush().
+ *
+ * Return: number of characters
+ */
+int VGA_write(const char * buff, int len)
+{
+        uint8_t enable_ints = 0;
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        for (int i = 0; i < len; i++)
+                put_char(buff[i]);
+
+        if (enable_ints)
+                STI;
+
+        return len;
+}
+
 /**
  * VGA_display_str() - print a string to BIOS VGA console
  * @str: String to print
@@ -107,11 +368,11 @@ int VGA_display_str(const char * str)
 {
         int ret = 0;
 
-        while (*str) {
-                VGA_display_char(*str);
-                str++;
+        while (str[ret])
                 ret++;
-        }
+
+        VGA_write(str, ret);
+        VGA_flush();
 
         return ret;
 }
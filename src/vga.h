@@ -12,6 +12,16 @@
 #define VGA_WIDTH                               80
 #define VGA_HEIGHT                              25
 
+/* The text window at 0xB8000 is 32 KiB; scrolling moves the CRTC start
+ * address through it and only copies when it runs out */
+#define VGA_WINDOW_CELLS                        (0x8000 / 2)
+#define VGA_WINDOW_ROWS                         (VGA_WINDOW_CELLS / VGA_WIDTH)
+
+#define VGA_CRTC_INDEX                          0x3D4
+#define VGA_CRTC_DATA                           0x3D5
+#define VGA_CRTC_START_HI                       0x0C
+#define VGA_CRTC_START_LO                       0x0D
+
 #define VGA_ROW(x)                              (x) / VGA_WIDTH
 #define VGA_COL(x)                              (x) % VGA_WIDTH
 
@@ -42,5 +52,9 @@ enum vga_color {
 int VGA_clear(void);
 int VGA_display_char(char);
 int VGA_display_str(const char *);
+int VGA_write(const char *, int);
+void VGA_flush(void);
+void VGA_disable(void);
+int VGA_text(char *, int);
 
 #endif /* #ifndef VGA_H */
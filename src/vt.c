@@ -0,0 +1,409 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/vt.c
+ *
+ * Virtual consoles
+ *
+ * Each console keeps its output in a ring of VT_SCROLLBACK bytes, oldest
+ * overwritten first, so writing one costs a store per character whether
+ * it's on screen or not.  Only the foreground console's output is passed on
+ * to the VGA and framebuffer consoles.  Switching consoles or scrolling back
+ * clears the screen and writes the part of the ring that should be visible
+ * through them again; the lines are found by walking back from the end, so
+ * that costs about a screen of text rather than the whole ring.
+ *
+ */
+
+#include <stdint.h>
+
+#include "fbcon.h"
+#include "irq.h"
+#include "printk.h"
+#include "vga.h"
+#include "vt.h"
+
+/**
+ * struct vt - one virtual console
+ * @text: Output, text[i % VT_SCROLLBACK] for the last VT_SCROLLBACK bytes i
+ * @head: Bytes ever written; the next one goes at text[head % VT_SCROLLBACK]
+ * @back: Screen rows scrolled back from the end; 0 while following output
+ */
+struct vt {
+        char text[VT_SCROLLBACK];
+        uint64_t head;
+        int back;
+};
+
+static struct vt vts[VT_COUNT];
+static int active = VT_LOG;
+
+static char at(struct vt * v, uint64_t i)
+{
+        return v->text[i % VT_SCROLLBACK];
+}
+
+/**
+ * oldest() - first byte of a console still in its ring
+ * @v: Console
+ *
+ * Return: byte index, in the same count as head
+ */
+static uint64_t oldest(struct vt * v)
+{
+        return v->head > VT_SCROLLBACK ? v->head - VT_SCROLLBACK : 0;
+}
+
+/**
+ * screen_size() - text size of whichever console is showing output
+ * @cols: Where to put the number of columns
+ * @rows: Where to put the number of rows
+ *
+ * Return: void
+ */
+static void screen_size(int * cols, int * rows)
+{
+        if (FB_text_size(cols, rows)) {
+                *cols = VGA_WIDTH;
+                *rows = VGA_HEIGHT;
+        }
+
+        return;
+}
+
+/**
+ * line_start() - find the start of the line a position is in
+ * @v: Console
+ * @pos: Byte index; the line is the one that writing here would extend
+ *
+ * Return: index just past the last newline before pos, or the oldest byte
+ */
+static uint64_t line_start(struct vt * v, uint64_t pos)
+{
+        uint64_t first = oldest(v);
+
+        while (pos > first && at(v, pos - 1) != '\n')
+                pos--;
+
+        return pos;
+}
+
+/**
+ * line_rows() - rows a line takes on screen
+ * @v: Console
+ * @start: First byte of the line
+ * @end: One past the last, not counting its newline
+ * @cols: Screen width
+ *
+ * Wraps the way the VGA and framebuffer consoles do: the cursor moves to
+ * the next row as soon as the last column is written.
+ *
+ * Return: number of rows, at least one
+ */
+static int line_rows(struct vt * v, uint64_t start, uint64_t end, int cols)
+{
+        int rows = 1, col = 0;
+
+        for (uint64_t i = start; i < end; i++) {
+                if (at(v, i) == '\r') {
+                        col = 0;
+                } else if (++col == cols) {
+                        rows++;
+                        col = 0;
+                }
+        }
+
+        return rows;
+}
+
+/**
+ * row_end() - find where one row of a wrapped line stops
+ * @v: Console
+ * @start: First byte of the line
+ * @end: One past the last, not counting its newline
+ * @cols: Screen width
+ * @row: Row of the line, counted from 0, that should end up at the bottom
+ *
+ * Return: index of the character that fills the last column of @row, so
+ *      writing up to it leaves the cursor on that row; @end if the row
+ *      doesn't fill up
+ */
+static uint64_t row_end(struct vt * v, uint64_t start, uint64_t end, int cols,
+                int row)
+{
+        int r = 0, col = 0;
+
+        for (uint64_t i = start; i < end; i++) {
+                if (at(v, i) == '\r') {
+                        col = 0;
+                        continue;
+                }
+
+                if (r == row && col == cols - 1)
+                        return i;
+
+                if (++col == cols) {
+                        r++;
+                        col = 0;
+                }
+        }
+
+        return end;
+}
+
+/**
+ * replay() - write part of a console's ring to the screen
+ * @v: Console
+ * @start: First byte
+ * @end: One past the last
+ *
+ * Return: void
+ */
+static void replay(struct vt * v, uint64_t start, uint64_t end)
+{
+        while (start < end) {
+                int off = start % VT_SCROLLBACK;
+                int n = VT_SCROLLBACK - off;
+
+                if (end - start < n)
+                        n = end - start;
+
+                VGA_write(v->text + off, n);
+                FB_write(v->text + off, n);
+                start += n;
+        }
+
+        return;
+}
+
+/**
+ * redraw() - put the foreground console back on screen; interrupts must be
+ *      off
+ *
+ * Finds the end of the view by going back v->back rows, counted the way
+ * they wrap on screen and clamped to what the ring still holds, then goes
+ * back further until there's at least a screen of rows.  Writing a little
+ * more than fits is fine; the screen just scrolls.  A view that ends part
+ * way through a wrapped line leaves the last column of its bottom row
+ * empty, since writing that character would move the cursor down a row.
+ *
+ * Return: void
+ */
+static void redraw(void)
+{
+        struct vt * v = &vts[active];
+        uint64_t first = oldest(v), end = v->head, start;
+        int cols, rows, n, back = v->back;
+
+        screen_size(&cols, &rows);
+
+        while (back > 0) {
+                uint64_t line = line_start(v, end);
+
+                n = line_rows(v, line, end, cols);
+
+                if (back < n) {
+                        end = row_end(v, line, end, cols, n - 1 - back);
+                        break;
+                }
+
+                /* Nothing older; stop with the first row at the bottom */
+                if (line == first) {
+                        v->back -= back - (n - 1);
+                        end = row_end(v, line, end, cols, 0);
+                        break;
+                }
+
+                back -= n;
+                end = line - 1;
+        }
+
+        start = line_start(v, end);
+        n = line_rows(v, start, end, cols);
+
+        while (start > first && n < rows) {
+                uint64_t line = line_start(v, start - 1);
+
+                n += line_rows(v, line, start - 1, cols);
+                start = line;
+        }
+
+        VGA_clear();
+        FB_clear();
+        replay(v, start, end);
+        VGA_flush();
+        FB_flush();
+
+        return;
+}
+
+/**
+ * VT_write() - write a run of characters to a virtual console
+ * @vt: Console, 0 to VT_COUNT - 1
+ * @buff: Characters to print
+ * @len: Number of characters
+ *
+ * Output for the foreground console only reaches the screen at the next
+ * VT_flush(), and output for the rest doesn't touch it at all.
+ *
+ * Return: number of characters, or -1 if there's no such console
+ */
+int VT_write(int vt, const char * buff, int len)
+{
+        uint8_t enable_ints = 0;
+        struct vt * v;
+
+        if (vt < 0 || vt >= VT_COUNT)
+                return -1;
+
+        v = &vts[vt];
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        for (int i = 0; i < len; i++)
+                v->text[v->head++ % VT_SCROLLBACK] = buff[i];
+
+        /* A console that's scrolled back holds still until it's let go */
+        if (vt == active && !v->back) {
+                VGA_write(buff, len);
+                FB_write(buff, len);
+        }
+
+        if (enable_ints)
+                STI;
+
+        return len;
+}
+
+/**
+ * VT_flush() - show everything written to the foreground console so far
+ *
+ * Return: void
+ */
+void VT_flush()
+{
+        VGA_flush();
+        FB_flush();
+
+        return;
+}
+
+/**
+ * VT_sync() - show everything written to the foreground console, now
+ *
+ * Unlike VT_flush(), doesn't leave any of a large update for later.
+ *
+ * Context: for panics
+ *
+ * Return: void
+ */
+void VT_sync()
+{
+        VGA_flush();
+        FB_sync();
+
+        return;
+}
+
+/**
+ * VT_switch() - bring a virtual console to the foreground
+ * @vt: Console, 0 to VT_COUNT - 1
+ *
+ * Shows the end of its output, even if it was already in the foreground
+ * but scrolled back.
+ *
+ * Context: ISR safe
+ *
+ * Return: void
+ */
+void VT_switch(int vt)
+{
+        uint8_t enable_ints = 0;
+
+        if (vt < 0 || vt >= VT_COUNT)
+                return;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        if (vt != active || vts[vt].back) {
+                active = vt;
+                vts[vt].back = 0;
+                redraw();
+        }
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * VT_scroll() - scroll the foreground console through its scrollback
+ * @dir: Positive to go back half a screen, negative to come forward
+ *
+ * Context: ISR safe
+ *
+ * Return: void
+ */
+void VT_scroll(int dir)
+{
+        struct vt * v = &vts[active];
+        uint8_t enable_ints = 0;
+        int cols, rows, back;
+
+        if (interrupts_enabled()) {
+                enable_ints = 1;
+                CLI;
+        }
+
+        screen_size(&cols, &rows);
+
+        back = v->back + (dir > 0 ? rows / 2 : -(rows / 2));
+        if (back < 0)
+                back = 0;
+
+        if (back != v->back) {
+                v->back = back;
+                redraw();
+        }
+
+        if (enable_ints)
+                STI;
+
+        return;
+}
+
+/**
+ * VT_input() - echo a typed character on the foreground console
+ * @c: Character
+ *
+ * Typing goes back to the end of the output first.  On the log console it
+ * goes through printk_echo() so it stays in order with kernel messages and
+ * reaches serial too, whatever the console level.
+ *
+ * Context: ISR safe
+ *
+ * Return: void
+ */
+void VT_input(char c)
+{
+        int vt = active;
+
+        if (vts[vt].back)
+                VT_switch(vt);
+
+        if (vt == VT_LOG) {
+                printk_echo(&c, 1);
+                return;
+        }
+
+        VT_write(vt, &c, 1);
+        VT_flush();
+
+        return;
+}
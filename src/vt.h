@@ -0,0 +1,25 @@
+/*
+ * Ryan Jacoby <ryjacoby@calpoly.edu>
+ * fragaria/src/vt.h
+ *
+ * Header for virtual consoles
+ *
+ */
+
+#ifndef VT_H
+#define VT_H                                    1
+
+#define VT_COUNT                                4       /* Alt+F1 to F4 */
+#define VT_LOG                                  0       /* where printk goes */
+
+/* Bytes of output kept per console; a power of two */
+#define VT_SCROLLBACK                           0x8000
+
+int VT_write(int, const char *, int);
+void VT_flush(void);
+void VT_sync(void);
+void VT_switch(int);
+void VT_scroll(int);
+void VT_input(char);
+
+#endif /* #ifndef VT_H */